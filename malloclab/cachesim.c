@@ -0,0 +1,106 @@
+/*
+ * cachesim.c - a cache and TLB simulator for the driver (mdriver -M)
+ *
+ * Each level is an array of sets of ways. A way holds the tag of the
+ * line (or page) plus one, so that zero means empty, and the time of
+ * its last use; a miss replaces the way used longest ago. Sets are
+ * searched linearly, which is quick enough for 16 ways.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cachesim.h"
+
+#define LINE_BITS 6    /* 64-byte lines */
+#define PAGE_BITS 12   /* 4 KB pages */
+
+typedef struct {
+    uint64_t tag;      /* line or page number + 1; 0 if empty */
+    uint64_t used;     /* time of last use */
+} way_t;
+
+static struct {
+    const char *name;
+    size_t sets, ways;
+    way_t *w;
+} levels[SIM_NLEVELS] = {
+    [SIM_L1]   = { "L1",   (32 << 10) / 64 / 8,   8,  NULL },
+    [SIM_L2]   = { "L2",   (1 << 20) / 64 / 16,   16, NULL },
+    [SIM_LLC]  = { "LLC",  (32 << 20) / 64 / 16,  16, NULL },
+    [SIM_DTLB] = { "dTLB", 64 / 4,                4,  NULL },
+    [SIM_STLB] = { "STLB", 1536 / 12,             12, NULL },
+};
+
+static uintptr_t base;
+static uint64_t now;
+static unsigned long long accesses;
+static unsigned long long misses[SIM_NLEVELS];
+
+/* Look key up in level l, filling it in on a miss. Returns 1 on a hit. */
+static int lookup(int l, uint64_t key)
+{
+    way_t *set = levels[l].w + (key % levels[l].sets) * levels[l].ways;
+    way_t *victim = set;
+    size_t i;
+
+    now++;
+    for (i = 0; i < levels[l].ways; i++) {
+        if (set[i].tag == key + 1) {
+            set[i].used = now;
+            return 1;
+        }
+        if (set[i].used < victim->used)
+            victim = &set[i];
+    }
+    misses[l]++;
+    victim->tag = key + 1;
+    victim->used = now;
+    return 0;
+}
+
+void cachesim_reset(const void *b)
+{
+    int l;
+
+    for (l = 0; l < SIM_NLEVELS; l++) {
+        if (levels[l].w == NULL &&
+            (levels[l].w = malloc(levels[l].sets * levels[l].ways *
+                                  sizeof(way_t))) == NULL) {
+            fprintf(stderr, "cachesim: out of memory\n");
+            exit(1);
+        }
+        memset(levels[l].w, 0, levels[l].sets * levels[l].ways * sizeof(way_t));
+    }
+    base = (uintptr_t)b;
+    now = 0;
+    accesses = 0;
+    memset(misses, 0, sizeof(misses));
+}
+
+void cachesim_access(const void *addr, size_t size)
+{
+    uint64_t a = (uintptr_t)addr - base;
+    uint64_t line, last = (a + (size ? size : 1) - 1) >> LINE_BITS;
+
+    accesses++;
+    for (line = a >> LINE_BITS; line <= last; line++) {
+        if (!lookup(SIM_L1, line) && !lookup(SIM_L2, line))
+            lookup(SIM_LLC, line);
+    }
+    if (!lookup(SIM_DTLB, a >> PAGE_BITS))
+        lookup(SIM_STLB, a >> PAGE_BITS);
+}
+
+void cachesim_counts(unsigned long long *acc,
+                     unsigned long long m[SIM_NLEVELS])
+{
+    *acc = accesses;
+    memcpy(m, misses, sizeof(misses));
+}
+
+const char *cachesim_name(int level)
+{
+    return levels[level].name;
+}
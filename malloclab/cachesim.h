@@ -0,0 +1,42 @@
+/*
+ * cachesim.h - a cache and TLB simulator for the driver (mdriver -M)
+ *
+ * The simulator models a fixed hierarchy, the same on every machine, so
+ * that two runs over the same accesses give the same misses exactly:
+ *
+ *   L1   32 KB, 8-way, 64-byte lines
+ *   L2   1 MB, 16-way
+ *   LLC  32 MB, 16-way
+ *   dTLB 64 entries, 4-way, 4 KB pages
+ *   STLB 1536 entries, 12-way, behind the dTLB
+ *
+ * Every level is LRU and allocates on both loads and stores. A line
+ * looked up in L2 missed in L1, and so on down. Addresses are taken
+ * relative to a base, so that where the heap happens to be mapped does
+ * not change which sets it falls in.
+ */
+#include <stddef.h>
+
+/* Levels modelled */
+enum {
+    SIM_L1,
+    SIM_L2,
+    SIM_LLC,
+    SIM_DTLB,
+    SIM_STLB,
+    SIM_NLEVELS
+};
+
+/* Empty every level and zero the counts; later addresses are taken
+   relative to base */
+void cachesim_reset(const void *base);
+
+/* Simulate a load or store of size bytes at addr */
+void cachesim_access(const void *addr, size_t size);
+
+/* The accesses simulated since the reset, and the misses at each level */
+void cachesim_counts(unsigned long long *accesses,
+                     unsigned long long misses[SIM_NLEVELS]);
+
+/* Name of level, for reports */
+const char *cachesim_name(int level);
@@ -9,10 +9,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/times.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
+#endif
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -34,14 +42,37 @@ static unsigned cyc_hi = 0;
 static unsigned cyc_lo = 0;
 
 
+/* Not every CPU, or CPU model a VM presents (QEMU's qemu64, say), has
+   rdtscp (CPUID 80000001H, EDX bit 27). Probed on first use; -1 until
+   then. */
+static int rdtscp_ok = -1;
+
+static int have_rdtscp()
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if (rdtscp_ok < 0)
+        rdtscp_ok = __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) != 0 &&
+            ((edx >> 27) & 1);
+    return rdtscp_ok;
+}
+
 /* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
+   The read is fenced (see read_counter_serial), so that the code being
+   timed can neither start early nor finish late. Without rdtscp, an
+   lfence before rdtsc does the waiting. */
 void access_counter(unsigned *hi, unsigned *lo)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-        : "=r" (*hi), "=r" (*lo)                /* and move results to */
-        : /* No input */                        /* the two outputs */
-        : "%edx", "%eax");
+    if (have_rdtscp())
+        asm volatile("rdtscp; lfence"          /* Read cycle counter */
+                     : "=d" (*hi), "=a" (*lo)  /* into the two outputs */
+                     : /* No input */
+                     : "%ecx", "memory");
+    else
+        asm volatile("lfence; rdtsc; lfence"
+                     : "=d" (*hi), "=a" (*lo)
+                     : /* No input */
+                     : "memory");
 }
 
 /* Record the current value of the cycle counter. */
@@ -50,6 +81,41 @@ void start_counter()
     access_counter(&cyc_hi, &cyc_lo);
 }
 
+/* Return the raw value of the cycle counter, for code that needs to
+   take its own timestamps without disturbing start_counter(). */
+unsigned long long read_counter()
+{
+    unsigned hi, lo;
+
+    asm volatile("rdtsc" : "=d" (hi), "=a" (lo));
+    return ((unsigned long long) hi << 32) | lo;
+}
+
+/* Like read_counter, but serialized: rdtscp (or lfence; rdtsc) waits
+   for the instructions before it to finish, and the lfence keeps later
+   ones from starting before the counter has been read. */
+unsigned long long read_counter_serial()
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long) hi << 32) | lo;
+}
+
+/* The time stamp counter is invariant if it ticks at a constant rate
+   through frequency changes and sleep states (CPUID 80000007H, EDX
+   bit 8); only then does it measure time. */
+int tsc_invariant()
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+        eax < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+}
+
 /* Return the number of cycles since the last call to start_counter. */
 double get_counter()
 {
@@ -117,6 +183,21 @@ void start_counter()
     cyc_lo = counter();
 }
 
+unsigned long long read_counter()
+{
+    return counter();
+}
+
+unsigned long long read_counter_serial()
+{
+    return counter();
+}
+
+int tsc_invariant()
+{
+    return 0;
+}
+
 double get_counter()
 {
     unsigned ncyc_hi, ncyc_lo;
@@ -152,6 +233,24 @@ void start_counter()
     exit(1);
 }
 
+unsigned long long read_counter()
+{
+    printf("ERROR: You are trying to use a read_counter routine in clock.c\n");
+    printf("that has not been implemented yet on this platform.\n");
+    printf("Please choose another timing package in config.h.\n");
+    exit(1);
+}
+
+unsigned long long read_counter_serial()
+{
+    return read_counter();
+}
+
+int tsc_invariant()
+{
+    return 0;
+}
+
 double get_counter() 
 {
     printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
@@ -181,42 +280,55 @@ double ovhd()
 }
 
 /* $begin mhz */
-/* Get the clock rate from /proc */
-double mhz_full(int verbose, int sleeptime __attribute__((unused)))
+/*
+ * clock_pair - Read CLOCK_MONOTONIC_RAW, in ns, and set *cyc to the
+ *     cycle counter at the same moment: the middle of the tightest of a
+ *     few counter reads taken around the clock read
+ */
+static double clock_pair(unsigned long long *cyc)
 {
-    static char buf[2048];
-
-    FILE *fp = fopen("/proc/cpuinfo", "r");
-    double mhz = 0.0;
+    struct timespec ts;
+    unsigned long long before, after, best = ~0ULL;
+    double ns = 0;
+    int i;
 
-    while (fgets(buf, 2048, fp)) {
-        if (strstr(buf, "cpu MHz")) {
-            sscanf(buf, "cpu MHz\t: %lf", &mhz);
-            break;
+    for (i = 0; i < 5; i++) {
+        before = read_counter_serial();
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        after = read_counter_serial();
+        if (after - before < best) {
+            best = after - before;
+            *cyc = before + best / 2;
+            ns = ts.tv_sec * 1e9 + ts.tv_nsec;
         }
     }
-    fclose(fp);
-    if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", mhz);
-    return mhz;
-
-#if 0
-    double rate;
+    return ns;
+}
 
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
+/* Calibrate the cycle counter against CLOCK_MONOTONIC_RAW over msecs
+   milliseconds. The rate is only a clock rate if tsc_invariant(). */
+double mhz_full(int verbose, int msecs)
+{
+    struct timespec nap;
+    unsigned long long c0, c1;
+    double ns0, ns1, rate;
+
+    nap.tv_sec = msecs / 1000;
+    nap.tv_nsec = (msecs % 1000) * 1000000L;
+    ns0 = clock_pair(&c0);
+    nanosleep(&nap, NULL);
+    ns1 = clock_pair(&c1);
+    rate = (c1 - c0) * 1e3 / (ns1 - ns0);
     if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", rate);
+        printf("Cycle counter rate ~= %.1f MHz\n", rate);
     return rate;
-#endif
 }
 /* $end mhz */
 
 /* Version using a default sleeptime */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    return mhz_full(verbose, 100);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
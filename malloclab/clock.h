@@ -6,14 +6,24 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Read the raw cycle counter without touching the start_counter() state */
+unsigned long long read_counter();
+
+/* Read the cycle counter once every earlier instruction has completed,
+   and before any later one starts, for timing short stretches of code */
+unsigned long long read_counter_serial();
+
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Is the counter invariant, i.e. a constant-rate clock? */
+int tsc_invariant();
+
+/* Determine the rate of the counter (calibrating for 100 ms) */
 double mhz(int verbose);
 
-/* Determine clock rate of processor, having more control over accuracy */
-double mhz_full(int verbose, int sleeptime);
+/* Determine the rate of the counter, calibrating for msecs milliseconds */
+double mhz_full(int verbose, int msecs);
 
 /** Special counters that compensate for timer interrupt overhead */
 
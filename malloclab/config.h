@@ -107,9 +107,12 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Default heap size in bytes for the driver (mdriver -m sets another).
+ * The driver maps it accessible up front, so it counts against address
+ * space limits and strict overcommit; pages are only used as the heap
+ * grows into them.
  */
-#define MAX_HEAP (100*(1<<20))  /* 100 MB */
+#define MAX_HEAP (1UL << 30)  /* 1 GB */
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
@@ -8,6 +8,7 @@
  * the time in CPU cycles for a function f.
  */
 #include <stdlib.h>
+#include <string.h>
 #include <sys/times.h>
 #include <stdio.h>
 
@@ -33,16 +34,20 @@ static int cache_block = CACHE_BLOCK;
 
 static int *cache_buf = NULL;
 
+static test_funct prepare = NULL;   /* run before each sample, untimed */
+static void *prepare_argp = NULL;
+static test_funct clear_fn = NULL;  /* clears the cache instead of clear() */
+static void *clear_argp = NULL;
+static int warmup = 0;              /* untimed runs before sampling */
+
 static double *values = NULL;
 static int samplecount = 0;
 
+/* every sample of the last fcyc call, in the order taken */
+static double *samples = NULL;
+
 /* for debugging only */
 #define KEEP_VALS 0
-#define KEEP_SAMPLES 0
-
-#if KEEP_SAMPLES
-static double *samples = NULL;
-#endif
 
 /* 
  * init_sampler - Start new sampling process 
@@ -52,12 +57,10 @@ static void init_sampler()
     if (values)
 	free(values);
     values = calloc(kbest, sizeof(double));
-#if KEEP_SAMPLES
     if (samples)
 	free(samples);
     /* Allocate extra for wraparound analysis */
     samples = calloc(maxsamples+kbest, sizeof(double));
-#endif
     samplecount = 0;
 }
 
@@ -74,9 +77,7 @@ static void add_sample(double val)
 	pos = kbest-1;
 	values[pos] = val;
     }
-#if KEEP_SAMPLES
     samples[samplecount] = val;
-#endif
     samplecount++;
     /* Insertion sort */
     while (pos > 0 && values[pos-1] > values[pos]) {
@@ -113,6 +114,9 @@ static void clear()
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* untouched pages all read as the one zero page, which would
+	   evict nothing */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -123,18 +127,37 @@ static void clear()
     sink = x;
 }
 
+/*
+ * fcyc_before_sample - Get ready for a sample as fcyc does: run the
+ *     prepare function and clear the cache, if asked to
+ */
+void fcyc_before_sample(void)
+{
+    if (prepare)
+	prepare(prepare_argp);
+    if (clear_cache) {
+	if (clear_fn)
+	    clear_fn(clear_argp);
+	else
+	    clear();
+    }
+}
+
 /*
  * fcyc - Use K-best scheme to estimate the running time of function f
  */
 double fcyc(test_funct f, void *argp)
 {
     double result;
+    int i;
+
+    for (i = 0; i < warmup; i++)
+	f(argp);
     init_sampler();
     if (compensate) {
 	do {
 	    double cyc;
-	    if (clear_cache)
-		clear();
+	    fcyc_before_sample();
 	    start_comp_counter();
 	    f(argp);
 	    cyc = get_comp_counter();
@@ -143,8 +166,7 @@ double fcyc(test_funct f, void *argp)
     } else {
 	do {
 	    double cyc;
-	    if (clear_cache)
-		clear();
+	    fcyc_before_sample();
 	    start_counter();
 	    f(argp);
 	    cyc = get_counter();
@@ -206,6 +228,113 @@ void set_fcyc_cache_block(int bytes) {
 }
 
 
+/*
+ * set_fcyc_clear - When set, clearing the cache calls f(argp) instead
+ *     of reading through a buffer of the cache size. NULL turns it off.
+ *     Default = NULL
+ */
+void set_fcyc_clear(test_funct f, void *argp)
+{
+    clear_fn = f;
+    clear_argp = argp;
+}
+
+/*
+ * fcyc_llc_size - The size in bytes of the last-level data cache, as
+ *     sysfs describes CPU 0's caches, or 0 if it cannot be found. Sets
+ *     *line to its line size.
+ */
+int fcyc_llc_size(int *line)
+{
+    char path[128], type[32];
+    FILE *f;
+    int i, level, size, best_level = 0, best_size = 0, ok;
+
+    for (i = 0; ; i++) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+	if ((f = fopen(path, "r")) == NULL)
+	    break;
+	ok = fscanf(f, "%d", &level) == 1;
+	fclose(f);
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+	if (!ok || (f = fopen(path, "r")) == NULL)
+	    continue;
+	ok = fscanf(f, "%31s", type) == 1 && strcmp(type, "Instruction") != 0;
+	fclose(f);
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if (!ok || level < best_level || (f = fopen(path, "r")) == NULL)
+	    continue;
+	ok = fscanf(f, "%dK", &size) == 1;
+	fclose(f);
+	if (!ok)
+	    continue;
+	best_level = level;
+	best_size = size * 1024;
+	*line = CACHE_BLOCK;
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/coherency_line_size", i);
+	if ((f = fopen(path, "r")) != NULL) {
+	    if (fscanf(f, "%d", line) != 1)
+		*line = CACHE_BLOCK;
+	    fclose(f);
+	}
+    }
+    return best_size;
+}
+
+/*
+ * fcyc_flush_range - Write back and evict every cache line of
+ *     [p, p + len) with clflush. Returns 0 where there is no such
+ *     instruction.
+ */
+int fcyc_flush_range(const void *p, size_t len)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    const char *q = (const char *)((unsigned long)p & ~(unsigned long)(cache_block - 1));
+    const char *end = (const char *)p + len;
+
+    for (; q < end; q += cache_block)
+	asm volatile("clflush %0" : : "m" (*q));
+    asm volatile("mfence" : : : "memory");
+    return 1;
+#else
+    (void)p;
+    (void)len;
+    return 0;
+#endif
+}
+
+/*
+ * set_fcyc_prepare - When set, will call f(argp) before each
+ *     measurement, outside the timed region (and before clearing
+ *     the cache). NULL turns it off.
+ *     Default = NULL
+ */
+void set_fcyc_prepare(test_funct f, void *argp)
+{
+    prepare = f;
+    prepare_argp = argp;
+}
+
+/*
+ * set_fcyc_warmup - Run f this many times, untimed, before taking
+ *     the first sample
+ *     Default = 0
+ */
+void set_fcyc_warmup(int n)
+{
+    warmup = n;
+}
+
+/*
+ * fcyc_samples - Point *s at the samples taken by the last call to
+ *     fcyc, in the order they were taken, and return how many
+ */
+int fcyc_samples(const double **s)
+{
+    *s = samples;
+    return samplecount;
+}
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -7,6 +7,8 @@
  *
  */
 
+#include <stddef.h>
+
 /* The test function takes a generic pointer as input */
 typedef void (*test_funct)(void *);
 
@@ -36,6 +38,54 @@ void set_fcyc_cache_size(int bytes);
  */
 void set_fcyc_cache_block(int bytes);
 
+/*
+ * set_fcyc_clear - When set, clearing the cache calls f(argp) instead
+ *     of reading through a buffer of the cache size. NULL turns it off.
+ *     Default = NULL
+ */
+void set_fcyc_clear(test_funct f, void *argp);
+
+/*
+ * fcyc_before_sample - Get ready for a sample as fcyc does: run the
+ *     prepare function and clear the cache, if asked to
+ */
+void fcyc_before_sample(void);
+
+/*
+ * fcyc_llc_size - The size in bytes of the last-level data cache, as
+ *     sysfs describes CPU 0's caches, or 0 if it cannot be found. Sets
+ *     *line to its line size.
+ */
+int fcyc_llc_size(int *line);
+
+/*
+ * fcyc_flush_range - Write back and evict every cache line of
+ *     [p, p + len) with clflush. Returns 0 where there is no such
+ *     instruction.
+ */
+int fcyc_flush_range(const void *p, size_t len);
+
+/*
+ * set_fcyc_prepare - When set, will call f(argp) before each
+ *     measurement, outside the timed region (and before clearing
+ *     the cache). NULL turns it off.
+ *     Default = NULL
+ */
+void set_fcyc_prepare(test_funct f, void *argp);
+
+/*
+ * set_fcyc_warmup - Run f this many times, untimed, before taking
+ *     the first sample
+ *     Default = 0
+ */
+void set_fcyc_warmup(int n);
+
+/*
+ * fcyc_samples - Point *s at the samples taken by the last call to
+ *     fcyc, in the order they were taken, and return how many
+ */
+int fcyc_samples(const double **s);
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -1,17 +1,48 @@
 /****************************
  * High-level timing wrappers
  ****************************/
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
-static double Mhz;  /* estimated CPU clock frequency */
+static double Mhz;  /* calibrated cycle counter rate, 0 if not invariant */
+
+/* K-best parameters and untimed warm-up runs (set_fsecs_params) */
+static int kbest = 3;
+static double epsilon = 0.01;
+static int maxsamples = 20;
+static int warmup = 0;
+
+/* the runs timed by the last fsecs call, in seconds, when the
+   clock_gettime fallback times them */
+static double *clock_times = NULL;
+static int clock_count = 0;
 
 extern int verbose; /* -v option in mdriver.c */
 
+/*
+ * set_fsecs_params - set the K-best parameters and warm-up runs, before
+ *     init_fsecs; 0 keeps the default
+ */
+void set_fsecs_params(int k, double eps, int max, int warm)
+{
+    if (k > 0)
+	kbest = k;
+    if (eps > 0)
+	epsilon = eps;
+    if (max > 0)
+	maxsamples = max;
+    if (warm > 0)
+	warmup = warm;
+    if (maxsamples < kbest)
+	maxsamples = kbest;
+}
+
 /*
  * init_fsecs - initialize the timing package
  */
@@ -20,15 +51,34 @@ void init_fsecs(void)
     Mhz = 0; /* keep gcc -Wall happy */
 
 #if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
+    int llc, line;
 
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
+    /* set key parameters for the fcyc package; clearing the cache means
+       reading through half as much again as the last-level cache */
+    set_fcyc_maxsamples(maxsamples); 
     set_fcyc_clear_cache(1);
     set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
+    set_fcyc_epsilon(epsilon);
+    set_fcyc_k(kbest);
+    set_fcyc_warmup(warmup);
+    if ((llc = fcyc_llc_size(&line)) > 0) {
+	set_fcyc_cache_size(llc + llc / 2);
+	set_fcyc_cache_block(line);
+    }
+
+    /* Cycles only convert to seconds if the counter keeps a constant
+       rate; otherwise time with the clock instead */
+    if (!tsc_invariant()) {
+	if (verbose)
+	    printf("No invariant cycle counter; measuring performance with clock_gettime().\n");
+	if ((clock_times = calloc(maxsamples, sizeof(double))) == NULL) {
+	    fprintf(stderr, "init_fsecs: out of memory\n");
+	    exit(1);
+	}
+	return;
+    }
+    if (verbose)
+	printf("Measuring performance with a cycle counter.\n");
     Mhz = mhz(verbose > 0);
 #elif USE_ITIMER
     if (verbose)
@@ -45,8 +95,25 @@ void init_fsecs(void)
 double fsecs(fsecs_test_funct f, void *argp) 
 {
 #if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
+    double best;
+    int i;
+
+    if (Mhz == 0) {
+	for (i = 0; i < warmup; i++)
+	    f(argp);
+	/* prepare and clear the cache before each run, as fcyc would */
+	for (i = 0; i < maxsamples; i++) {
+	    fcyc_before_sample();
+	    ftimer_clock(f, argp, 1, &clock_times[i]);
+	}
+	clock_count = maxsamples;
+	best = clock_times[0];
+	for (i = 1; i < maxsamples; i++)
+	    if (clock_times[i] < best)
+		best = clock_times[i];
+	return best;
+    }
+    return fcyc(f, argp)/(Mhz*1e6);
 #elif USE_ITIMER
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
@@ -54,4 +121,55 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * fsecs_spread - Describe the runs timed by the last call to fsecs:
+ *     set the fastest, the median and the standard deviation, in
+ *     seconds, and whether the K fastest agreed within epsilon. Returns
+ *     the number of runs, 0 if the timer keeps no samples.
+ */
+int fsecs_spread(double *min, double *median, double *stddev,
+		 int *converged)
+{
+    const double *raw;
+    double *t, scale, mean = 0, var = 0;
+    int i, n;
+
+#if USE_FCYC
+    if (Mhz == 0) {
+	raw = clock_times;
+	n = clock_count;
+	scale = 1;
+    } else {
+	n = fcyc_samples(&raw);
+	scale = 1 / (Mhz*1e6);
+    }
+#else
+    raw = NULL;
+    n = 0;
+    scale = 1;
+#endif
+    if (n == 0 || (t = malloc(n * sizeof(double))) == NULL)
+	return 0;
+    for (i = 0; i < n; i++) {
+	t[i] = raw[i] * scale;
+	mean += t[i];
+    }
+    mean /= n;
+    for (i = 0; i < n; i++)
+	var += (t[i] - mean) * (t[i] - mean);
+    qsort(t, n, sizeof(double), cmp_double);
 
+    *min = t[0];
+    *median = (n % 2) ? t[n/2] : (t[n/2 - 1] + t[n/2]) / 2;
+    *stddev = sqrt(var / n);
+    *converged = n >= kbest && (1 + epsilon) * t[0] >= t[kbest-1];
+    free(t);
+    return n;
+}
@@ -1,4 +1,6 @@
 typedef void (*fsecs_test_funct)(void *);
 
+void set_fsecs_params(int k, double epsilon, int maxsamples, int warmup);
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+int fsecs_spread(double *min, double *median, double *stddev, int *converged);
@@ -12,3 +12,8 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+
+/* Estimate the running time of f(argp) using CLOCK_MONOTONIC_RAW.
+   Return the fastest of n runs, and the time of each in times[] if
+   it is not NULL */
+double ftimer_clock(ftimer_test_funct f, void *argp, int n, double *times);
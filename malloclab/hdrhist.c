@@ -0,0 +1,66 @@
+/*
+ * hdrhist.c - high dynamic range histograms of cycle counts
+ *
+ * Bucket i < 2^HDR_SUB_BITS holds the value i. Above that, a value v
+ * with its top bit at position b is shifted right by e = b -
+ * HDR_SUB_BITS + 1, leaving a mantissa m in [2^(S-1), 2^S), and goes to
+ * bucket e * 2^(S-1) + m, which continues the exact buckets without a
+ * gap. Bucket i then holds [m << e, (m + 1) << e).
+ */
+#include <string.h>
+
+#include "hdrhist.h"
+
+#define HALF (1ULL << (HDR_SUB_BITS - 1))
+
+void hdrhist_reset(hdrhist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void hdrhist_record(hdrhist_t *h, unsigned long long v)
+{
+    int e;
+
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+    if (v < 2 * HALF) {
+        h->buckets[v]++;
+        return;
+    }
+    e = 63 - __builtin_clzll(v) - HDR_SUB_BITS + 1;
+    h->buckets[e * HALF + (v >> e)]++;
+}
+
+/* The largest value that lands in bucket i */
+static unsigned long long bucket_top(int i)
+{
+    unsigned long long e, m;
+
+    if ((unsigned long long)i < 2 * HALF)
+        return i;
+    e = i / HALF - 1;
+    m = i - e * HALF;
+    return ((m + 1) << e) - 1;
+}
+
+unsigned long long hdrhist_percentile(const hdrhist_t *h, double pct)
+{
+    unsigned long long rank, seen = 0, top;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+    /* the smallest value at or above pct percent of the values */
+    rank = (unsigned long long)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (i = 0; i < HDR_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+    top = bucket_top(i < HDR_BUCKETS ? i : HDR_BUCKETS - 1);
+    return top < h->max ? top : h->max;
+}
@@ -0,0 +1,26 @@
+/*
+ * hdrhist.h - high dynamic range histograms of cycle counts
+ *
+ * Values below 2^HDR_SUB_BITS are counted exactly. Above that, each
+ * power of two is split into 2^(HDR_SUB_BITS-1) equal buckets, so a
+ * value is known to within 1 part in 64 anywhere in the 64-bit range,
+ * in a fixed 30 KB. Recording is one bit scan and an increment.
+ */
+#define HDR_SUB_BITS 7
+#define HDR_BUCKETS ((66 - HDR_SUB_BITS) << (HDR_SUB_BITS - 1))
+
+typedef struct {
+    unsigned long long count;  /* values recorded */
+    unsigned long long max;    /* ... and the largest, exactly */
+    unsigned long long buckets[HDR_BUCKETS];
+} hdrhist_t;
+
+/* Empty h */
+void hdrhist_reset(hdrhist_t *h);
+
+/* Record one value */
+void hdrhist_record(hdrhist_t *h, unsigned long long v);
+
+/* The value below which pct percent of the recorded values lie: the top
+   of the bucket the percentile falls in, but never above the max */
+unsigned long long hdrhist_percentile(const hdrhist_t *h, double pct);
@@ -0,0 +1,282 @@
+/*
+ * heapprof.c - sampling heap profiler for the mm malloc package
+ *
+ * The allocator decrements heapprof_countdown by the size of every
+ * request; when it goes negative the request is sampled. The distance
+ * to the next sample is drawn from an exponential distribution with
+ * the configured mean, so that sampling cannot lock onto a periodic
+ * allocation pattern. While sampling is off the countdown is parked at
+ * LONG_MAX, so the only cost to mm_malloc is one subtract and compare.
+ *
+ * A sample records the backtrace of the request in a table of distinct
+ * stacks, and links the block to its stack in a table keyed by address
+ * so that mm_free can find it again. Both tables are mapped directly
+ * with mmap (see rawmem.h): the profiler must never call malloc, since
+ * in the interpositioning build malloc is the allocator being profiled.
+ *
+ * heapprof_dump writes the legacy gperftools "heap_v2" text format,
+ * which pprof reads and unsamples. Each record carries both the live
+ * (inuse) and cumulative (alloc) counts, selected in pprof with
+ * -inuse_space and -alloc_space.
+ */
+#include <execinfo.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "heapprof.h"
+#include "rawmem.h"
+
+#define HP_MAX_DEPTH 32          /* frames recorded per stack */
+#define HP_SKIP 2                /* heapprof_sample and malloc itself */
+#define HP_STACKS (1 << 14)      /* distinct stacks (power of two) */
+#define HP_BLOCKS (1 << 16)      /* live sampled blocks (power of two) */
+
+typedef struct {
+    uint64_t hash;               /* 0 marks an empty slot */
+    int depth;
+    void *pc[HP_MAX_DEPTH];
+    long live_count, live_bytes; /* sampled blocks still allocated */
+    long alloc_count, alloc_bytes; /* all sampled blocks ever */
+} hp_stack_t;
+
+typedef struct {
+    void *bp;                    /* key first; NULL marks an empty slot */
+    int stack;                   /* index into stacks */
+    size_t size;
+} hp_block_t;
+
+long heapprof_countdown = LONG_MAX;
+
+static size_t interval = 0;
+static uint64_t rng_state = 0;
+static int busy = 0;             /* guards against recursion via backtrace */
+static hp_stack_t *stacks = NULL;
+static hp_block_t *blocks = NULL;
+
+/*
+ * next_interval - Bytes until the next sample, exponentially distributed
+ *     with mean interval (xorshift64* supplies the uniform variate)
+ */
+static long next_interval(void)
+{
+    double u;
+
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    u = ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+    return (long)(-log(1.0 - u) * interval) + 1;
+}
+
+/*
+ * find_stack - Return the index of the stack pc[0..depth-1], adding it
+ *     if it has not been seen before, or -1 if the table is full
+ */
+static int find_stack(void **pc, int depth)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int i, n;
+
+    for (i = 0; i < depth; i++)
+        h = (h ^ (uint64_t)(uintptr_t)pc[i]) * 1099511628211ULL;
+    if (h == 0)
+        h = 1;
+
+    for (n = 0, i = h & (HP_STACKS - 1); n < HP_STACKS;
+         n++, i = (i + 1) & (HP_STACKS - 1)) {
+        hp_stack_t *s = &stacks[i];
+        if (s->hash == 0) {
+            s->hash = h;
+            s->depth = depth;
+            memcpy(s->pc, pc, depth * sizeof(void *));
+            return i;
+        }
+        if (s->hash == h && s->depth == depth &&
+            memcmp(s->pc, pc, depth * sizeof(void *)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void heapprof_start(size_t interval_arg)
+{
+    heapprof_stop();
+    if (interval_arg == 0)
+        return;
+
+    stacks = raw_map(HP_STACKS * sizeof(hp_stack_t));
+    blocks = raw_map(HP_BLOCKS * sizeof(hp_block_t));
+    if (stacks == NULL || blocks == NULL) {
+        heapprof_stop();
+        return;
+    }
+
+    /* backtrace may allocate the first time it is called; do that now
+       rather than from inside the allocator */
+    {
+        void *pc[HP_MAX_DEPTH];
+        busy = 1;
+        backtrace(pc, HP_MAX_DEPTH);
+        busy = 0;
+    }
+
+    rng_state = ((uint64_t)time(NULL) << 16) ^ (uint64_t)getpid() ^ 1;
+    interval = interval_arg;
+    heapprof_countdown = next_interval();
+}
+
+void heapprof_stop(void)
+{
+    if (stacks)
+        munmap(stacks, HP_STACKS * sizeof(hp_stack_t));
+    if (blocks)
+        munmap(blocks, HP_BLOCKS * sizeof(hp_block_t));
+    stacks = NULL;
+    blocks = NULL;
+    interval = 0;
+    heapprof_countdown = LONG_MAX;
+}
+
+void heapprof_dump_to_env(void)
+{
+    char path[64];
+    char *s = getenv("MM_HEAPPROF_FILE");
+
+    /* no more samples: the exit path may still allocate */
+    heapprof_countdown = LONG_MAX;
+    if (s == NULL) {
+        snprintf(path, sizeof(path), "mm.%d.heap", (int)getpid());
+        s = path;
+    }
+    heapprof_dump(s);
+}
+
+int heapprof_start_from_env(void)
+{
+    char *s = getenv("MM_HEAPPROF");
+    if (s == NULL || interval != 0)
+        return 0;
+    heapprof_start(strtoul(s, NULL, 0));
+    return interval != 0;
+}
+
+int heapprof_sample(void *bp, size_t size)
+{
+    void *pc[HP_MAX_DEPTH + HP_SKIP];
+    int depth, stack;
+    size_t i, n;
+
+    if (interval == 0) {
+        heapprof_countdown = LONG_MAX;
+        return 0;
+    }
+    heapprof_countdown = next_interval();
+    if (busy)
+        return 0;
+
+    busy = 1;
+    depth = backtrace(pc, HP_MAX_DEPTH + HP_SKIP) - HP_SKIP;
+    busy = 0;
+    if (depth <= 0)
+        return 0;
+    if ((stack = find_stack(pc + HP_SKIP, depth)) < 0)
+        return 0;
+
+    /* linear probing; give up quietly if the block table is full */
+    for (n = 0, i = raw_hash_ptr(bp) & (HP_BLOCKS - 1); blocks[i].bp != NULL;
+         n++, i = (i + 1) & (HP_BLOCKS - 1))
+        if (n == HP_BLOCKS)
+            return 0;
+    blocks[i].bp = bp;
+    blocks[i].stack = stack;
+    blocks[i].size = size;
+
+    stacks[stack].live_count++;
+    stacks[stack].live_bytes += size;
+    stacks[stack].alloc_count++;
+    stacks[stack].alloc_bytes += size;
+    return 1;
+}
+
+void heapprof_free(void *bp)
+{
+    long i;
+    hp_stack_t *s;
+
+    if (blocks == NULL)
+        return;
+    if ((i = raw_table_find(blocks, sizeof(hp_block_t), HP_BLOCKS, bp)) < 0)
+        return;
+
+    s = &stacks[blocks[i].stack];
+    s->live_count--;
+    s->live_bytes -= blocks[i].size;
+    raw_table_delete(blocks, sizeof(hp_block_t), HP_BLOCKS, i);
+}
+
+int heapprof_dump(const char *path)
+{
+    char buf[4096];
+    long live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    int fd, maps, i, k, len;
+    ssize_t n;
+
+    if (stacks == NULL)
+        return -1;
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+
+    busy = 1;
+    for (i = 0; i < HP_STACKS; i++) {
+        live_count += stacks[i].live_count;
+        live_bytes += stacks[i].live_bytes;
+        alloc_count += stacks[i].alloc_count;
+        alloc_bytes += stacks[i].alloc_bytes;
+    }
+    len = snprintf(buf, sizeof(buf),
+                   "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%zu\n",
+                   live_count, live_bytes, alloc_count, alloc_bytes, interval);
+    if (raw_write_all(fd, buf, len) < 0)
+        goto fail;
+
+    for (i = 0; i < HP_STACKS; i++) {
+        hp_stack_t *s = &stacks[i];
+        if (s->hash == 0)
+            continue;
+        len = snprintf(buf, sizeof(buf), "%ld: %ld [%ld: %ld] @",
+                       s->live_count, s->live_bytes,
+                       s->alloc_count, s->alloc_bytes);
+        for (k = 0; k < s->depth; k++)
+            len += snprintf(buf + len, sizeof(buf) - len, " %p", s->pc[k]);
+        buf[len++] = '\n';
+        if (raw_write_all(fd, buf, len) < 0)
+            goto fail;
+    }
+
+    /* pprof needs the mappings to symbolize the addresses */
+    len = snprintf(buf, sizeof(buf), "\nMAPPED_LIBRARIES:\n");
+    if (raw_write_all(fd, buf, len) < 0)
+        goto fail;
+    if ((maps = open("/proc/self/maps", O_RDONLY)) >= 0) {
+        while ((n = read(maps, buf, sizeof(buf))) > 0)
+            if (raw_write_all(fd, buf, n) < 0)
+                break;
+        close(maps);
+    }
+
+    busy = 0;
+    return close(fd);
+
+ fail:
+    busy = 0;
+    close(fd);
+    return -1;
+}
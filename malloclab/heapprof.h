@@ -0,0 +1,38 @@
+/*
+ * heapprof.h - sampling heap profiler for the mm malloc package
+ *
+ * When enabled, roughly one allocation per heapprof interval bytes is
+ * sampled and its call stack recorded. Sampled blocks are remembered so
+ * that mm_free can retire them from the live profile again.
+ */
+#include <stddef.h>
+
+/* Bytes left before the next sample; mm.c decrements this on every malloc */
+extern long heapprof_countdown;
+
+/* Start sampling, on average once every interval bytes (0 stops) */
+void heapprof_start(size_t interval);
+
+/* Stop sampling and drop everything recorded so far */
+void heapprof_stop(void);
+
+/* Start sampling if MM_HEAPPROF=<interval> is set in the environment.
+   Returns 1 if sampling started; the caller should then arrange for
+   heapprof_dump_to_env to run when the program exits. */
+int heapprof_start_from_env(void);
+
+/* Stop sampling and write the profile to $MM_HEAPPROF_FILE (default
+   mm.<pid>.heap). The caller must hold the lock under which the
+   allocator calls heapprof_sample and heapprof_free. */
+void heapprof_dump_to_env(void);
+
+/* Called by mm.c when the countdown expires. Returns 1 if the block
+   at bp was sampled and must be reported to heapprof_free later. */
+int heapprof_sample(void *bp, size_t size);
+
+/* Called by mm.c when a sampled block is freed */
+void heapprof_free(void *bp);
+
+/* Write the live and cumulative profiles to path in pprof heap format.
+   Returns 0 on success, -1 on error. */
+int heapprof_dump(const char *path);
@@ -0,0 +1,176 @@
+/*
+ * locality.c - placement quality of an allocator (mdriver -O)
+ *
+ * Coverage is kept as a count of live blocks on each line of the heap,
+ * and a count of live lines on each page, so that a line or page joins
+ * the live set when its count leaves zero and leaves it when the count
+ * returns there. Both arrays grow with the highest address seen.
+ *
+ * Recent frees sit in a ring of LOC_WINDOW entries, each stamped with
+ * the number of allocations made before it; an allocation returning an
+ * address in the ring within LOC_WINDOW allocations of its free counts
+ * as a reuse. A free pushed out of the ring by later frees no longer
+ * counts, so bursts of more than LOC_WINDOW frees are scored short.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hdrhist.h"
+#include "locality.h"
+
+#define LINES_PER_PAGE (LOC_PAGE / LOC_LINE)
+
+typedef struct {
+    const char *p;              /* NULL once reused */
+    unsigned long long stamp;   /* allocations made before the free */
+} freed_t;
+
+static const char *base;
+static uint16_t *line_count;    /* live blocks on each line */
+static uint8_t *page_count;     /* live lines on each page */
+static size_t nlines;           /* entries in line_count */
+static size_t live_lines, live_pages;
+static size_t live_bytes;
+
+static const char *last;        /* the last allocation, or NULL */
+static unsigned long long nallocs;
+static freed_t ring[LOC_WINDOW];
+static int ring_next;
+static hdrhist_t dist;
+static locality_t res;
+
+/* Grow the count arrays to cover lines [0, n) */
+static void grow(size_t n)
+{
+    size_t old = nlines, npages;
+
+    if (n <= nlines)
+        return;
+    nlines = (nlines == 0) ? LINES_PER_PAGE : nlines;
+    while (nlines < n)
+        nlines *= 2;
+    npages = nlines / LINES_PER_PAGE;
+    if ((line_count = realloc(line_count, nlines * sizeof(*line_count))) == NULL ||
+        (page_count = realloc(page_count, npages * sizeof(*page_count))) == NULL)
+        abort();
+    memset(line_count + old, 0, (nlines - old) * sizeof(*line_count));
+    memset(page_count + old / LINES_PER_PAGE, 0,
+           npages - old / LINES_PER_PAGE);
+}
+
+/* Add (delta 1) or remove (delta -1) the payload [p, p+size) */
+static void cover(const char *p, size_t size, int delta)
+{
+    size_t l, first, end;
+
+    if (size == 0 || p < base)
+        return;
+    first = (size_t)(p - base) / LOC_LINE;
+    end = (size_t)(p + size - 1 - base) / LOC_LINE + 1;
+    grow(end);
+    for (l = first; l < end; l++) {
+        if (delta > 0) {
+            if (line_count[l]++ == 0) {
+                live_lines++;
+                if (page_count[l / LINES_PER_PAGE]++ == 0)
+                    live_pages++;
+            }
+        } else if (--line_count[l] == 0) {
+            live_lines--;
+            if (--page_count[l / LINES_PER_PAGE] == 0)
+                live_pages--;
+        }
+    }
+    if (delta > 0) {
+        live_bytes += size;
+        if (live_bytes > res.peak_bytes) {
+            res.peak_bytes = live_bytes;
+            res.lines = live_lines;
+            res.pages = live_pages;
+        }
+    } else
+        live_bytes -= size;
+}
+
+/* Score the placement of a new block at p */
+static void placed(const char *p)
+{
+    unsigned long long d;
+    int i;
+
+    if (last != NULL) {
+        d = (p > last) ? (unsigned long long)(p - last)
+                       : (unsigned long long)(last - p);
+        hdrhist_record(&dist, d);
+        res.allocs++;
+        res.near += (d < LOC_PAGE);
+    }
+    last = p;
+
+    for (i = 0; i < LOC_WINDOW; i++)
+        if (ring[i].p == p && nallocs - ring[i].stamp < LOC_WINDOW) {
+            res.reused++;
+            res.reused_next += (ring[i].stamp == nallocs);
+            ring[i].p = NULL;
+            break;
+        }
+    nallocs++;
+}
+
+void locality_start(const void *heap_base)
+{
+    base = heap_base;
+    nlines = 0;
+    free(line_count);
+    free(page_count);
+    line_count = NULL;
+    page_count = NULL;
+    live_lines = live_pages = live_bytes = 0;
+    last = NULL;
+    nallocs = 0;
+    memset(ring, 0, sizeof(ring));
+    ring_next = 0;
+    hdrhist_reset(&dist);
+    memset(&res, 0, sizeof(res));
+}
+
+void locality_alloc(const void *p, size_t size)
+{
+    placed(p);
+    cover(p, size, 1);
+}
+
+void locality_free(const void *p, size_t size)
+{
+    if (p == NULL)
+        return;
+    cover(p, size, -1);
+    ring[ring_next].p = p;
+    ring[ring_next].stamp = nallocs;
+    ring_next = (ring_next + 1) % LOC_WINDOW;
+    res.frees++;
+}
+
+void locality_realloc(const void *oldp, size_t oldsize,
+                      const void *newp, size_t newsize)
+{
+    if (oldp != NULL)
+        cover(oldp, oldsize, -1);
+    if (newp == NULL)
+        return;
+    if (newp != oldp)     /* a block that moved was placed anew */
+        placed(newp);
+    cover(newp, newsize, 1);
+}
+
+void locality_stop(locality_t *loc)
+{
+    res.dist_p50 = hdrhist_percentile(&dist, 50);
+    *loc = res;
+    free(line_count);
+    free(page_count);
+    line_count = NULL;
+    page_count = NULL;
+    nlines = 0;
+}
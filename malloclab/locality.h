@@ -0,0 +1,42 @@
+/*
+ * locality.h - placement quality of an allocator (mdriver -O)
+ *
+ * The driver reports each block it gets back from the allocator, and
+ * the tracker scores where the blocks went: how far apart consecutive
+ * allocations land, how soon a freed address is handed out again, and
+ * how densely the live blocks pack the cache lines and pages they
+ * cover at the peak of the live bytes.
+ */
+#include <stddef.h>
+
+#define LOC_LINE   64     /* cache line size scored */
+#define LOC_PAGE   4096   /* page size scored */
+#define LOC_WINDOW 64     /* allocations after a free that count as reuse */
+
+typedef struct {
+    unsigned long long allocs;  /* allocations after the first... */
+    unsigned long long near;    /* ... within LOC_PAGE of the one before */
+    unsigned long long dist_p50;/* median distance between them, bytes */
+    unsigned long long frees;   /* frees of non-null blocks... */
+    unsigned long long reused;  /* ... whose address came back within
+                                   LOC_WINDOW allocations... */
+    unsigned long long reused_next; /* ... or in the very next one */
+    size_t peak_bytes;          /* live payload bytes at their peak... */
+    size_t lines, pages;        /* ... and the lines and pages they cover */
+} locality_t;
+
+/* Start tracking a heap that starts at base */
+void locality_start(const void *base);
+
+/* The allocator returned the size-byte payload p */
+void locality_alloc(const void *p, size_t size);
+
+/* The payload p of size bytes is about to be freed */
+void locality_free(const void *p, size_t size);
+
+/* The payload oldp of oldsize bytes was reallocated to newp */
+void locality_realloc(const void *oldp, size_t oldsize,
+                      const void *newp, size_t newsize);
+
+/* Stop tracking and fill in loc */
+void locality_stop(locality_t *loc);
@@ -7,9 +7,12 @@
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity */
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,11 +21,25 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "ftimer.h"
+#include "clock.h"
+#include "cachesim.h"
+#include "hdrhist.h"
+#include "locality.h"
+#include "heapprof.h"
+#include "perfctr.h"
+#include "repb.h"
+#include "tstream.h"
 #include "config.h"
 
 /**********************
@@ -34,9 +51,23 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/*
+ * Loop i over the requests of trace. A streamed trace (-S) comes n
+ * requests at a time, and op_xxx[i] is then request trace->op_first + i.
+ */
+#define FOR_EACH_OP(trace, i, n) \
+    for (n = trace_begin(trace); n > 0; n = trace_next(trace)) \
+        for (i = 0; i < n; i++)
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
+/* Buckets in the free-list search length histogram (powers of two) */
+#define PROF_BUCKETS 24
+
+/* Slowest requests of each type remembered by the latency pass (-L) */
+#define LAT_WORST 3
+
 /* weights */
 #define WNONE 0
 #define WALL 1
@@ -54,32 +85,44 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload. The ranges are kept in a
+ * skip list ordered by address; the list's head is a range_t with no
+ * extent and RANGE_LEVELS links.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
     int index;             /* same index as free; for debugging */
+    struct range_t *next[];/* next element on each of its levels */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
+/*
+ * Holds the information for one trace file. The requests are kept as
+ * three parallel arrays, in the layout of a .repb file (repb.h), so that
+ * a binary trace is replayed straight from its mapping.
+ */
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* old opt-out from range checks; now ignored */
     int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
+    long num_ops;        /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
+    uint8_t *op_type;    /* type of each request (ALLOC, FREE, REALLOC) */
+    int32_t *op_index;   /* block id for free() to use later */
+    uint64_t *op_size;   /* byte size of alloc/realloc request */
+    void *map;           /* the mapped .repb file, or NULL for a .rep */
+    size_t map_size;
+    tstream_t *stream;   /* with -S, the requests come a chunk at a time */
+    long op_first;       /* ... and op_xxx[0] is this request of the trace */
+    long op_count;       /* ... and op_xxx holds this many */
+    int num_slots;       /* entries in the three arrays below */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
+    int *live;           /* with -T, the slots of the live blocks... */
+    int *live_pos;       /* ... and each slot's place in live, or -1 */
+    int num_live;
 } trace_t;
 
 /*
@@ -92,6 +135,24 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Cost of one request, as measured by the profiling pass (-p) */
+typedef struct {
+    long opnum;            /* which request in the trace */
+    int type;              /* ... its type and size */
+    size_t size;
+    unsigned long visited; /* free-list nodes visited */
+    unsigned long long cycles;             /* total cycles for the request */
+    unsigned long long phase[MM_NPHASES];  /* ... and per internal phase */
+} opcost_t;
+
+/* Latency of the requests of one type in a trace, in cycles (-L) */
+typedef struct {
+    unsigned long long count;
+    unsigned long long p50, p99, p999, max;
+    int nworst;
+    long worst[LAT_WORST];     /* the slowest requests, slowest first */
+} lat_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -102,9 +163,31 @@ typedef struct {
     /* run-time stats defined for both libc and student */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double warm_secs;/* ... and with the caches left warm between runs */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    long minflt;     /* minor page faults replaying on a fresh heap (-F) */
+    size_t pages;    /* heap pages touched by that replay (-F) */
+    double cold_secs;/* time for that replay, first-touch cost included */
+    double rss_util; /* utilization relative to resident heap pages (-R) */
+    size_t peak_pages, final_pages; /* resident heap pages in that run */
+    int page_mode;   /* MEM_PAGES_xxx the huge-page heap really got (-g) */
+    double page_secs[2];  /* speed on small and on huge pages (-g) */
+    long long dtlb[2];    /* dTLB misses per replay on each, -1 if unknown */
+    long long events[PERFCTR_NEVENTS]; /* over one replay, -1 if unknown (-E) */
+    unsigned long long sim_accesses;   /* simulated metadata accesses ... */
+    unsigned long long sim_misses[SIM_NLEVELS]; /* ... and misses (-M) */
+    double cold_heap_secs;/* speed with the heap purged before each run (-W) */
+    int nsamples;         /* timed runs behind secs, 0 if not known ... */
+    double min_secs, median_secs, stddev_secs; /* ... and their spread */
+    int converged;        /* did the K fastest runs agree? */
+    lat_t lat[3];         /* latency of each request type, by ALLOC.. (-L) */
+    unsigned long long lat_overhead; /* timer cycles taken off each request */
+    locality_t loc;       /* placement of the blocks in the util run (-O) */
+    long peak_op;         /* request after which the live bytes peaked */
+    mm_waste_t waste;     /* the allocated blocks at that peak (-a) ... */
+    size_t waste_free, waste_heap; /* ... the free blocks and the heap */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -123,6 +206,14 @@ typedef unsigned char randint_t;
 static const char randint_t_name[] = "byte";
 static randint_t random_data[RANDOM_DATA_LEN];
 
+/*
+ * With -e <n>, DBG_EXPENSIVE checks n randomly chosen blocks every
+ * operation instead of all of them, and calls mm_checkheap only every
+ * CHECKHEAP_EVERY operations, so that large traces finish.
+ */
+#define CHECKHEAP_EVERY 1024
+static int check_sampled = 0;
+
 
 /********************
  * Global variables
@@ -137,6 +228,76 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* if nonzero, profile each trace and report this many slowest requests */
+static int prof_slowest = 0;
+
+/* if set, time every request and report the latency percentiles */
+static int latency = 0;
+
+/* if nonzero, sample the heap once every this many bytes (on average) */
+static size_t heapprof_interval = 0;
+
+/* if nonzero, write a fragmentation timeline sampled every this many requests */
+static long timeline_every = 0;
+
+/* if set, replay each trace on a fresh heap and count its page faults */
+static int count_faults = 0;
+
+/* if set, also score utilization against the resident heap pages */
+static int rss_util = 0;
+
+/* if not MEM_PAGES_SMALL, back the heap with huge pages and compare */
+static int huge_pages = MEM_PAGES_SMALL;
+
+/* bytes of address space reserved for each heap */
+static size_t max_heap = MAX_HEAP;
+
+/* if nonzero, prefault this many bytes of each heap and time it cold too */
+static size_t prefault_bytes = 0;
+
+/* if set, stream the requests from disk rather than loading them */
+static int stream_traces = 0;
+
+/* number of resident page samples taken over a trace by eval_mm_util */
+#define RSS_SAMPLES 256
+
+/* initial number of block slots for a streamed trace */
+#define STREAM_SLOTS 1024
+
+/* if not negative, run the driver on this CPU only */
+static int pin_cpu = -1;
+
+/* if not negative, run the driver under this scheduling policy */
+static int sched_policy = -1;
+
+/* if set, break down where the heap's bytes go at the peak */
+static int waste_breakdown = 0;
+
+/* if set, score where the allocator places the blocks */
+static int locality = 0;
+
+/* if set, replay each trace through the cache simulator */
+static int simulate = 0;
+
+/* if set, count hardware events over a replay of each trace */
+static int count_events = 0;
+
+/* if set, evict only the heap and trace with clflush before timed runs */
+static int clflush_caches = 0;
+
+/* if not negative, the timed replays write each new payload and read a
+   random live block before this percentage of the requests */
+static int touch_pct = -1;
+
+/* if set, report the spread of each trace's timed runs */
+static int report_spread = 0;
+
+/* if above 1, run the traces in this many worker processes */
+static int jobs = 1;
+
+/* set once the driver has timed out; later traces are not run */
+static volatile int timed_out = 0;
+
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -153,14 +314,21 @@ char autoresult[MAXLINE]; /* autoresult string */
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size,
-                     const trace_t *trace, int opnum, int index);
+static int add_range(range_t **ranges, char *lo, size_t size,
+                     const trace_t *trace, long opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
-static void check_index(const trace_t *trace, int opnum, int index);
+static void touch_pages(char *p, size_t size);
+static void app_begin(trace_t *trace);
+static void app_alloc(trace_t *trace, int index, char *p, size_t size);
+static void app_free(trace_t *trace, int index);
+static void app_read(trace_t *trace);
+static void check_index(const trace_t *trace, long opnum, int index);
+static long trace_begin(trace_t *trace);
+static long trace_next(trace_t *trace);
 static void randomize_block(trace_t *trace, int index);
 
 /* These functions read, allocate, and free storage for traces */
@@ -176,13 +344,36 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void purge_heap(void *ptr);
+static void replay_op(trace_t *trace, long i, int tracenum, const char *who);
+static void flush_caches(void *ptr);
+static void eval_mm_prof(trace_t *trace, int tracenum);
+static void eval_mm_latency(trace_t *trace, int tracenum, stats_t *stats);
+static void dump_heap_profile(const trace_t *trace);
+static FILE *timeline_open(const trace_t *trace);
+static void timeline_sample(FILE *f, long ops, size_t live);
+static void eval_mm_faults(speed_t *speed_params, stats_t *stats);
+static void eval_mm_pages(speed_t *speed_params, stats_t *stats);
+static void eval_mm_events(speed_t *speed_params, stats_t *stats);
+static void eval_mm_sim(trace_t *trace, int tracenum, stats_t *stats);
+static void eval_mm_waste(trace_t *trace, int tracenum, stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printfaults(int n, stats_t *stats);
+static void printrss(int n, stats_t *stats);
+static void printpages(int n, stats_t *stats);
+static void printwarmth(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printspread(int n, stats_t *stats);
+static void printevents(int n, stats_t *stats);
+static void printsim(int n, stats_t *stats);
+static void printlocality(int n, stats_t *stats);
+static void printwaste(int n, stats_t *stats);
 static void usage(void);
-static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+static void malloc_error(const trace_t *trace, long opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
 static void unix_error(const char *fmt, ...)
     __attribute__((format(printf, 1,2), noreturn));
@@ -198,56 +389,260 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
+/*
+ * run_trace - Evaluate the mm package on trace i, filling in stats.
+ *     Returns nonzero if the driver should stop after this trace (-c).
+ */
+static int run_trace(int i, const char *tracedir, char **tracefiles,
+                     stats_t *stats, range_t *ranges, speed_t *speed_params) {
+    /* initialize simulated memory system in memlib.c *
+     * start each trace with a clean system */
+    mem_ctx_t *ctx = mem_ctx_create(max_heap);
+    if (ctx == NULL)
+        unix_error("mem_ctx_create failed in run_tests");
+    mem_ctx_bind(ctx);
+
+    /* handle timeouts */
+    if(setjmp(timeout_jmpbuf) != 0) {
+        timed_out = 1;
+    }
+
+    trace_t *trace;
+    trace = read_trace(stats, tracedir, tracefiles[i]);
+    strcpy(stats->filename, trace->filename);
+    stats->ops = trace->num_ops;
+    if(timed_out) {
+        stats->valid = 0;
+    } else {
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness, ");
+        stats->valid = eval_mm_valid(trace, &ranges);
+
+        if (onetime_flag) {
+            free_trace(trace);
+            mem_ctx_destroy(ctx);
+            return 1;
+        }
+    }
+    if (stats->valid) {
+        if (verbose > 1)
+            printf("efficiency, ");
+        if (heapprof_interval > 0)
+            heapprof_start(heapprof_interval);
+        stats->util = eval_mm_util(trace, i, stats);
+        if (heapprof_interval > 0) {
+            dump_heap_profile(trace);
+            heapprof_stop();
+        }
+        if (waste_breakdown)
+            eval_mm_waste(trace, i, stats);
+        if (prof_slowest > 0)
+            eval_mm_prof(trace, i);
+        if (simulate)
+            eval_mm_sim(trace, i, stats);
+        speed_params->trace = trace;
+        speed_params->ranges = ranges;
+        if (verbose > 1)
+            printf("and performance.\n");
+        if (clflush_caches)
+            set_fcyc_clear(flush_caches, speed_params);
+        stats->secs = fsecs(eval_mm_speed, speed_params);
+        stats->nsamples = fsecs_spread(&stats->min_secs, &stats->median_secs,
+                                       &stats->stddev_secs, &stats->converged);
+        set_fcyc_clear_cache(0);
+        stats->warm_secs = fsecs(eval_mm_speed, speed_params);
+        set_fcyc_clear_cache(1);
+        if (count_events)
+            eval_mm_events(speed_params, stats);
+        if (latency)
+            eval_mm_latency(trace, i, stats);
+        if (prefault_bytes > 0) {
+            set_fcyc_prepare(purge_heap, NULL);
+            stats->cold_heap_secs = fsecs(eval_mm_speed, speed_params);
+            set_fcyc_prepare(NULL, NULL);
+        }
+        if (count_faults)
+            eval_mm_faults(speed_params, stats);
+        if (huge_pages != MEM_PAGES_SMALL)
+            eval_mm_pages(speed_params, stats);
+        set_fcyc_clear(NULL, NULL);
+    }
+
+    free_trace(trace);
+
+    /* clean up memory system */
+    mem_ctx_destroy(ctx);
+    return 0;
+}
+
 /* Run the tests; return the number of tests run (may be less than
    num_tracefiles, if there's a timeout) */
 static void run_tests(int num_tracefiles, const char *tracedir,
                       char **tracefiles,
                       stats_t *mm_stats, range_t *ranges, speed_t *speed_params) {
-    volatile int i;
-    volatile int timed_out = 0;
+    int i;
 
     for (i=0; i < num_tracefiles; i++) {
-        /* initialize simulated memory system in memlib.c *
-         * start each trace with a clean system */
-        mem_init();
+        if (run_trace(i, tracedir, tracefiles, &mm_stats[i], ranges,
+                      speed_params))
+            return;
+    }
+}
+
+/*
+ * cpu_order - Fill cpus with the CPUs this process may run on, one
+ *     hardware thread of each core first and their SMT siblings after,
+ *     so that the first workers get a core each. Returns how many.
+ */
+static int cpu_order(int *cpus, int max)
+{
+    cpu_set_t set;
+    char path[MAXLINE];
+    FILE *f;
+    int cpu, first, pass, n = 0;
 
-        /* handle timeouts */
-        if(setjmp(timeout_jmpbuf) != 0) {
-            timed_out = 1;
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        return 0;
+    for (pass = 0; pass < 2; pass++) {
+        for (cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+            if (!CPU_ISSET(cpu, &set))
+                continue;
+            /* the first CPU in a core's sibling list stands for the core */
+            first = cpu;
+            sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+            if ((f = fopen(path, "r")) != NULL) {
+                if (fscanf(f, "%d", &first) != 1)
+                    first = cpu;
+                fclose(f);
+            }
+            if ((first == cpu) == (pass == 0))
+                cpus[n++] = cpu;
         }
+    }
+    return n;
+}
 
-        trace_t *trace;
-        trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
-        strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
-        if(timed_out) {
-            mm_stats[i].valid = 0;
-        } else {
-            if (verbose > 1)
-                printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid = eval_mm_valid(trace, &ranges);
+/*
+ * isolate - Pin the driver to pin_cpu (-C) and run it under
+ *     sched_policy (-P), so that the rest of the machine disturbs the
+ *     timings less. A real-time policy gets its lowest priority, which
+ *     is still above every ordinary process.
+ */
+static void isolate(void)
+{
+    struct sched_param param;
+    cpu_set_t set;
+
+    if (pin_cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(pin_cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            unix_error("cannot pin the driver to the CPU given with -C");
+    }
+    if (sched_policy >= 0) {
+        memset(&param, 0, sizeof(param));
+        if (sched_policy == SCHED_FIFO || sched_policy == SCHED_RR)
+            param.sched_priority = sched_get_priority_min(sched_policy);
+        if (sched_setscheduler(0, sched_policy, &param) < 0)
+            unix_error("cannot set the scheduling policy given with -P");
+    }
+}
 
-            if (onetime_flag) {
-                free_trace(trace);
-                return;
-            }
+/*
+ * run_tests_parallel - Run the tests in jobs worker processes (-j). Each
+ *     worker is pinned to a CPU of its own and takes the next trace not
+ *     yet started until none are left, evaluating it on its own heap.
+ *     The stats come back through shared memory, in trace order. What
+ *     a worker prints for a trace (-V progress, -p tables, heap profile
+ *     and error messages) goes to a temporary file of that trace's own,
+ *     which is copied to stdout, in trace order, once all are done.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               range_t *ranges, speed_t *speed_params) {
+    struct {
+        int next;           /* next trace to start */
+        int errors;         /* errors found by all the workers */
+    } *shared;
+    stats_t *stats;
+    FILE **out;
+    char buf[BUFSIZ];
+    size_t len;
+    int cpus[CPU_SETSIZE];
+    int ncpus, w, i, status;
+    cpu_set_t set;
+    pid_t pid;
+
+    ncpus = cpu_order(cpus, CPU_SETSIZE);
+    if (jobs > num_tracefiles)
+        jobs = num_tracefiles;
+    if (ncpus > 0 && jobs > ncpus) {
+        if (verbose)
+            printf("Running %d worker%s, one per CPU\n", ncpus,
+                   ncpus > 1 ? "s" : "");
+        jobs = ncpus;
+    }
+
+    shared = mmap(NULL, sizeof(*shared) + num_tracefiles * sizeof(stats_t),
+                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        unix_error("mmap failed in run_tests_parallel");
+    stats = (stats_t *)(shared + 1);
+    memcpy(stats, mm_stats, num_tracefiles * sizeof(stats_t));
+    shared->next = 0;
+    shared->errors = 0;
+
+    if ((out = calloc(num_tracefiles, sizeof(FILE *))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+    for (i = 0; i < num_tracefiles; i++)
+        if ((out[i] = tmpfile()) == NULL)
+            unix_error("tmpfile failed in run_tests_parallel");
+
+    /* a worker's timeout is its own; the alarm is not inherited */
+    alarm(0);
+    fflush(stdout);
+    for (w = 0; w < jobs; w++) {
+        if ((pid = fork()) < 0)
+            unix_error("fork failed in run_tests_parallel");
+        if (pid > 0)
+            continue;
+
+        if (ncpus > 0) {
+            CPU_ZERO(&set);
+            CPU_SET(cpus[w], &set);
+            sched_setaffinity(0, sizeof(set), &set);
         }
-        if (mm_stats[i].valid) {
-            if (verbose > 1)
-                printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
-            speed_params->trace = trace;
-            speed_params->ranges = ranges;
-            if (verbose > 1)
-                printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+        if (set_timeout > 0)
+            alarm(set_timeout);
+        while ((i = __atomic_fetch_add(&shared->next, 1, __ATOMIC_RELAXED))
+               < num_tracefiles) {
+            fflush(stdout);
+            if (dup2(fileno(out[i]), STDOUT_FILENO) < 0)
+                unix_error("dup2 failed in run_tests_parallel");
+            run_trace(i, tracedir, tracefiles, &stats[i], ranges, speed_params);
         }
+        __atomic_fetch_add(&shared->errors, errors, __ATOMIC_RELAXED);
+        fflush(stdout);
+        _exit(0);
+    }
 
-        free_trace(trace);
-
-        /* clean up memory system */
-        mem_deinit();
+    /* a worker that dies leaves its trace invalid */
+    while ((pid = wait(&status)) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "A worker process failed\n");
+            errors++;
+        }
+    }
+    for (i = 0; i < num_tracefiles; i++) {
+        rewind(out[i]);
+        while ((len = fread(buf, 1, sizeof(buf), out[i])) > 0)
+            fwrite(buf, 1, len, stdout);
+        fclose(out[i]);
     }
+    free(out);
+    memcpy(mm_stats, stats, num_tracefiles * sizeof(stats_t));
+    errors += shared->errors;
+    munmap(shared, sizeof(*shared) + num_tracefiles * sizeof(stats_t));
 }
 
 /**************
@@ -280,7 +675,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:e:f:c:g:i:j:m:p:s:t:u:v:C:H:K:P:T:W:hVAlaDbEFLMORSz")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -334,10 +729,147 @@ int main(int argc, char **argv)
             debug_mode = DBG_EXPENSIVE;
             break;
 
+        case 'e': /* Expensive checks on a sample of the blocks */
+            check_sampled = atoi(optarg);
+            if (check_sampled <= 0)
+                app_error("-e needs a positive number of blocks");
+            debug_mode = DBG_EXPENSIVE;
+            break;
+
         case 's':
             set_timeout = atoi(optarg);
             break;
 
+        case 'p': /* Profile the allocator and report the slowest requests */
+            prof_slowest = atoi(optarg);
+            break;
+
+        case 'i': /* Write a fragmentation timeline */
+            timeline_every = atol(optarg);
+            if (timeline_every <= 0)
+                app_error("-i needs a positive number of requests");
+            break;
+
+        case 'H': /* Sample the heap during the utilization run */
+            heapprof_interval = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'b': /* Grow only the simulated break, no sbrk syscall */
+            mem_set_real_sbrk(0);
+            break;
+
+        case 'F': /* Count page faults on a fresh heap */
+            count_faults = 1;
+            break;
+
+        case 'E': /* Count hardware events */
+            count_events = 1;
+            break;
+
+        case 'M': /* Replay through the cache simulator */
+            if (!mm_sim_built)
+                app_error("-M needs mdriver.sim, built with an instrumented mm.c");
+            simulate = 1;
+            break;
+
+        case 'a': /* Break down the heap at its peak */
+            waste_breakdown = 1;
+            break;
+
+        case 'O': /* Score the placement of the blocks */
+            locality = 1;
+            break;
+
+        case 'L': /* Report the latency of individual requests */
+            latency = 1;
+            break;
+
+        case 'R': /* Report utilization against resident pages too */
+            rss_util = 1;
+            break;
+
+        case 'g': /* Back the heap with huge pages */
+            if (strcmp(optarg, "thp") == 0)
+                huge_pages = MEM_PAGES_HUGE;
+            else if (strcmp(optarg, "hugetlb") == 0)
+                huge_pages = MEM_PAGES_HUGETLB;
+            else {
+                usage();
+                exit(1);
+            }
+            mem_set_page_mode(huge_pages);
+            break;
+
+        case 'm': /* Reserve a bigger (or smaller) heap */
+            max_heap = strtoul(optarg, NULL, 0);
+            if (max_heap == 0)
+                app_error("-m needs a heap size in bytes");
+            break;
+
+        case 'W': /* Prefault the heap; time it warm and cold */
+            prefault_bytes = strtoul(optarg, NULL, 0);
+            mem_set_prefault(prefault_bytes);
+            break;
+
+        case 'j': /* Run the traces in parallel worker processes */
+            jobs = atoi(optarg);
+            break;
+
+        case 'T': /* Touch the payloads as an application would */
+            touch_pct = atoi(optarg);
+            if (touch_pct < 0 || touch_pct > 100)
+                app_error("-T needs a percentage from 0 to 100");
+            break;
+
+        case 'S': /* Stream the traces instead of loading them */
+            stream_traces = 1;
+            break;
+
+        case 'z': /* Evict just the heap and trace with clflush */
+            if (!fcyc_flush_range(NULL, 0))
+                app_error("-z needs the clflush instruction");
+            clflush_caches = 1;
+            break;
+
+        case 'C': /* Pin the driver to one CPU */
+            pin_cpu = atoi(optarg);
+            report_spread = 1;
+            break;
+
+        case 'P': /* Scheduling policy */
+            if (strcmp(optarg, "fifo") == 0)
+                sched_policy = SCHED_FIFO;
+            else if (strcmp(optarg, "rr") == 0)
+                sched_policy = SCHED_RR;
+            else if (strcmp(optarg, "batch") == 0)
+                sched_policy = SCHED_BATCH;
+            else if (strcmp(optarg, "other") == 0)
+                sched_policy = SCHED_OTHER;
+            else {
+                usage();
+                exit(1);
+            }
+            report_spread = 1;
+            break;
+
+        case 'u': /* Untimed warm-up runs before the timed ones */
+            set_fsecs_params(0, 0, 0, atoi(optarg));
+            report_spread = 1;
+            break;
+
+        case 'K': { /* K-best parameters: k[,epsilon[,maxsamples]] */
+            int k = 0, max = 0;
+            double eps = 0;
+
+            if (sscanf(optarg, "%d,%lf,%d", &k, &eps, &max) < 1 || k <= 0) {
+                usage();
+                exit(1);
+            }
+            set_fsecs_params(k, eps, max, 0);
+            report_spread = 1;
+            break;
+        }
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -358,6 +890,9 @@ int main(int argc, char **argv)
         init_random_data();
     }
 
+    /* Keep the measurements apart from the rest of the machine */
+    isolate();
+
     /* Initialize the timing package */
     init_fsecs();
 
@@ -391,13 +926,17 @@ int main(int argc, char **argv)
                 if (verbose > 1)
                     printf("and performance.\n");
                 libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                set_fcyc_clear_cache(0);
+                libc_stats[i].warm_secs = fsecs(eval_libc_speed, &speed_params);
+                set_fcyc_clear_cache(1);
             }
             free_trace(trace);
         }
 
         /* Display the libc results in a compact table */
         if (verbose) {
-            printf("\nResults for libc malloc:\n");
+            printf("\nResults for libc malloc%s:\n",
+                   touch_pct >= 0 ? ", payloads touched" : "");
             printresults(num_tracefiles, libc_stats);
         }
     }
@@ -413,8 +952,12 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
-              ranges, &speed_params);
+    if (jobs > 1 && !onetime_flag)
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats,
+                           ranges, &speed_params);
+    else
+        run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                  ranges, &speed_params);
 
 
     /* Display the mm results in a compact table */
@@ -427,8 +970,49 @@ int main(int argc, char **argv)
                 printf(" => incorrect.\n\n");
             }
         } else {
-            printf("\nResults for mm malloc:\n");
+            printf("\nResults for mm malloc%s:\n",
+                   touch_pct >= 0 ? ", payloads touched" : "");
             printresults(num_tracefiles, mm_stats);
+            if (count_faults) {
+                printf("\nPage faults for mm malloc:\n");
+                printfaults(num_tracefiles, mm_stats);
+            }
+            if (rss_util) {
+                printf("\nResident heap pages for mm malloc:\n");
+                printrss(num_tracefiles, mm_stats);
+            }
+            if (huge_pages != MEM_PAGES_SMALL) {
+                printf("\nPage sizes for mm malloc:\n");
+                printpages(num_tracefiles, mm_stats);
+            }
+            if (prefault_bytes > 0) {
+                printf("\nWarm and cold heap for mm malloc:\n");
+                printwarmth(num_tracefiles, mm_stats);
+            }
+            if (waste_breakdown) {
+                printf("\nHeap bytes at the peak for mm malloc:\n");
+                printwaste(num_tracefiles, mm_stats);
+            }
+            if (locality) {
+                printf("\nPlacement of the blocks by mm malloc:\n");
+                printlocality(num_tracefiles, mm_stats);
+            }
+            if (simulate) {
+                printf("\nSimulated metadata accesses for mm malloc, per request:\n");
+                printsim(num_tracefiles, mm_stats);
+            }
+            if (count_events) {
+                printf("\nHardware events for mm malloc, per request:\n");
+                printevents(num_tracefiles, mm_stats);
+            }
+            if (report_spread || verbose > 1) {
+                printf("\nTiming spread for mm malloc:\n");
+                printspread(num_tracefiles, mm_stats);
+            }
+            if (latency) {
+                printf("\nRequest latency for mm malloc, in cycles:\n");
+                printlatency(num_tracefiles, mm_stats);
+            }
             printf("\n");
         }
     }
@@ -549,19 +1133,74 @@ int main(int argc, char **argv)
  * The following routines manipulate the range list, which keeps
  * track of the extent of every allocated block payload. We use the
  * range list to detect any overlapping allocated blocks.
+ *
+ * The list is a skip list in address order. Payloads that were accepted
+ * never overlap, so a new payload can only overlap the ranges just
+ * before and after it, and each check costs O(log n).
  ****************************************************************/
 
+#define RANGE_LEVELS 24   /* enough for 2^24 live blocks at full speed */
+
+/*
+ * xorshift - the driver's own generator, not random(), so that the debug
+ *     data written into blocks does not depend on the range list or on
+ *     which blocks -e samples
+ */
+static unsigned long long xorshift(void)
+{
+    static unsigned long long x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+/*
+ * range_level - pick the level of a new range: level l with probability
+ *     2^-(l+1)
+ */
+static int range_level(void)
+{
+    unsigned long long x = xorshift();
+    int level = 1;
+
+    while (level < RANGE_LEVELS && (x >> (level - 1) & 1))
+        level++;
+    return level;
+}
+
+/*
+ * find_range - fill before[l] with the last range on level l that starts
+ *     below lo (the head if none), and return the first range on level 0
+ *     that starts at or above lo, or NULL
+ */
+static range_t *find_range(range_t *head, char *lo, range_t **before)
+{
+    range_t *p = head;
+    int l;
+
+    for (l = RANGE_LEVELS - 1; l >= 0; l--) {
+        while (p->next[l] != NULL && p->next[l]->lo < lo)
+            p = p->next[l];
+        before[l] = p;
+    }
+    return p->next[0];
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
  *     we create a range struct for this block and add it to the range list.
  */
-static int add_range(range_t **ranges, char *lo, int size,
-                     const trace_t *trace, int opnum, int index)
+static int add_range(range_t **ranges, char *lo, size_t size,
+                     const trace_t *trace, long opnum, int index)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *before[RANGE_LEVELS];
+    range_t *p, *after;
+    int l, level;
 
     assert(size > 0);
 
@@ -581,33 +1220,43 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
+    /* With debugging off we check less thoroughly and just assume the
+       overlap will be caught by writing random bits. */
+    if(debug_mode == DBG_NONE) return 1;
 
+    if (*ranges == NULL) {
+        if ((*ranges = calloc(1, sizeof(range_t) +
+                              RANGE_LEVELS * sizeof(range_t *))) == NULL)
+            unix_error("malloc error in add_range");
+    }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            malloc_error(trace, opnum,
-                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                         lo, hi, p->lo, p->hi);
-            return 0;
-        }
+    after = find_range(*ranges, lo, before);
+    p = before[0];
+    if ((p != *ranges && p->hi >= lo) || (after != NULL && after->lo <= hi)) {
+        if (p == *ranges || p->hi < lo)
+            p = after;
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, p->lo, p->hi);
+        return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
      * by creating a range struct and adding it the range list.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
+    level = range_level();
+    if ((p = (range_t *)malloc(sizeof(range_t) +
+                               level * sizeof(range_t *))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
     p->index = index;
-    *ranges = p;
+    for (l = 0; l < level; l++) {
+        p->next[l] = before[l]->next[l];
+        before[l]->next[l] = p;
+    }
 
     return 1;
 }
@@ -617,17 +1266,18 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t *before[RANGE_LEVELS];
     range_t *p;
-    range_t **prevpp = ranges;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    int l;
+
+    if (*ranges == NULL)
+        return;
+    p = find_range(*ranges, lo, before);
+    if (p == NULL || p->lo != lo)
+        return;
+    for (l = 0; l < RANGE_LEVELS && before[l]->next[l] == p; l++)
+        before[l]->next[l] = p->next[l];
+    free(p);
 }
 
 /*
@@ -639,7 +1289,7 @@ static void clear_ranges(range_t **ranges)
     range_t *pnext;
 
     for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
+        pnext = p->next[0];
         free(p);
     }
     *ranges = NULL;
@@ -660,32 +1310,58 @@ static void init_random_data(void) {
     }
 }
 
-static void randomize_block(trace_t *traces, int index) {
-    size_t size;
-    size_t i;
-    randint_t *block;
-    int base;
+/*
+ * The data for a block is random_data read from base onwards, wrapping
+ * around at the end. Blocks are filled and checked a segment at a time
+ * with memcpy and memcmp, which libc vectorizes; only a block that fails
+ * the comparison is walked byte by byte to count the damage.
+ */
+static void fill_random(randint_t *block, size_t size, int base) {
+    size_t off = base % RANDOM_DATA_LEN;
+    size_t len;
+
+    while(size > 0) {
+        len = RANDOM_DATA_LEN - off;
+        if(len > size) len = size;
+        memcpy(block, random_data + off, len * sizeof(*block));
+        block += len;
+        size -= len;
+        off = 0;
+    }
+}
 
-    if(debug_mode == DBG_NONE) return;
+static int match_random(const randint_t *block, size_t size, int base) {
+    size_t off = base % RANDOM_DATA_LEN;
+    size_t len;
 
-    traces->block_rand_base[index] = random();
+    while(size > 0) {
+        len = RANDOM_DATA_LEN - off;
+        if(len > size) len = size;
+        if(memcmp(block, random_data + off, len * sizeof(*block)) != 0)
+            return 0;
+        block += len;
+        size -= len;
+        off = 0;
+    }
+    return 1;
+}
 
-    block = (randint_t*)traces->blocks[index];
-    size = traces->block_sizes[index] / sizeof(*block);
-    base = traces->block_rand_base[index];
+static void randomize_block(trace_t *traces, int index) {
+    if(debug_mode == DBG_NONE) return;
 
-    for(i = 0; i < size; i++) {
-        block[i] = random_data[(base + i) % RANDOM_DATA_LEN];
-    }
+    traces->block_rand_base[index] = random();
+    fill_random((randint_t*)traces->blocks[index],
+                traces->block_sizes[index] / sizeof(randint_t),
+                traces->block_rand_base[index]);
 }
 
-static void check_index(const trace_t *trace, int opnum, int index) {
+static void check_index(const trace_t *trace, long opnum, int index) {
     size_t size;
     size_t i;
     randint_t *block;
     int base;
-    int ngarbled = 0;
-    int firstgarbled = -1;
+    size_t ngarbled = 0;
+    size_t firstgarbled = 0;
 
     if(index < 0) return; /* we're doing free(NULL) */
     if(debug_mode == DBG_NONE) return;
@@ -694,16 +1370,38 @@ static void check_index(const trace_t *trace, int opnum, int index) {
     size = trace->block_sizes[index] / sizeof(*block);
     base = trace->block_rand_base[index];
 
+    if(match_random(block, size, base)) return;
+
     for(i = 0; i < size; i++) {
         if(block[i] != random_data[(base + i) % RANDOM_DATA_LEN]) {
-            if(firstgarbled == -1) firstgarbled = i;
+            if(ngarbled == 0) firstgarbled = i;
             ngarbled++;
         }
     }
-    if(ngarbled != 0) {
-        malloc_error(trace, opnum, "block %d has %d garbled %s%s, "
-                     "starting at byte %zu", index, ngarbled, randint_t_name,
-                     ngarbled > 1 ? "s" : "", sizeof(randint_t) * firstgarbled);
+    malloc_error(trace, opnum, "block %d has %zu garbled %s%s, "
+                 "starting at byte %zu", index, ngarbled, randint_t_name,
+                 ngarbled > 1 ? "s" : "", sizeof(randint_t) * firstgarbled);
+}
+
+/*
+ * check_sample - check the data of n live blocks picked at random: each
+ *     is the first block at or above a random address in the heap (the
+ *     lowest block if there is none), so every live block is reached,
+ *     blocks after large gaps more often
+ */
+static void check_sample(const trace_t *trace, long opnum, range_t *ranges,
+                         int n) {
+    range_t *before[RANGE_LEVELS];
+    range_t *r;
+    char *lo = mem_heap_lo();
+    size_t span = mem_heapsize();
+
+    if(ranges == NULL || ranges->next[0] == NULL || span == 0) return;
+
+    while(n-- > 0) {
+        r = find_range(ranges, lo + xorshift() % span, before);
+        if(r == NULL) r = ranges->next[0];
+        check_index(trace, opnum, r->index);
     }
 }
 
@@ -712,87 +1410,110 @@ static void check_index(const trace_t *trace, int opnum, int index) {
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * map_trace - map a binary (.repb) trace file, whose requests are then
+ *     replayed in place
  */
-static trace_t *read_trace(stats_t *stats, const char *tracedir,
-                           const char *filename)
+static void map_trace(trace_t *trace)
+{
+    repb_header_t *h;
+    struct stat st;
+    long i;
+    int fd;
+
+    if ((fd = open(trace->filename, O_RDONLY)) < 0)
+        unix_error("Could not open %s in read_trace", trace->filename);
+    if (fstat(fd, &st) < 0)
+        unix_error("Could not stat %s in read_trace", trace->filename);
+    if ((size_t)st.st_size < sizeof(repb_header_t))
+        app_error("%s: truncated binary trace\n", trace->filename);
+    trace->map_size = st.st_size;
+    if ((trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE,
+                           fd, 0)) == MAP_FAILED)
+        unix_error("Could not map %s in read_trace", trace->filename);
+    close(fd);
+
+    h = trace->map;
+    if (memcmp(h->magic, REPB_MAGIC, sizeof(h->magic)) != 0 ||
+        h->order != REPB_ORDER)
+        app_error("%s: not a binary trace for this machine\n", trace->filename);
+    if (!repb_check(h, trace->map_size) || h->num_ids < 0)
+        app_error("%s: corrupt binary trace header\n", trace->filename);
+
+    trace->weight = h->weight;
+    trace->num_ids = h->num_ids;
+    trace->num_ops = h->num_ops;
+    trace->ignore_ranges = h->ignore_ranges;
+    trace->op_type = (uint8_t *)trace->map + h->type_off;
+    trace->op_index = (int32_t *)((char *)trace->map + h->index_off);
+    trace->op_size = (uint64_t *)((char *)trace->map + h->size_off);
+
+    /* replay indexes the block arrays with the ids unchecked, so check
+       every request once here */
+    for (i = 0; i < trace->num_ops; i++) {
+        if (trace->op_type[i] > REALLOC)
+            app_error("%s: corrupt binary trace: bogus request type %d "
+                      "at request %ld\n", trace->filename, trace->op_type[i], i);
+        if (trace->op_index[i] >= trace->num_ids ||
+            (trace->op_index[i] < 0 && trace->op_type[i] != FREE))
+            app_error("%s: corrupt binary trace: block id %d out of range "
+                      "at request %ld\n", trace->filename, trace->op_index[i], i);
+    }
+
+    /* replay reads the arrays front to back */
+    madvise(trace->map, trace->map_size, MADV_SEQUENTIAL);
+}
+
+/*
+ * parse_trace - read a text (.rep) trace file into memory
+ */
+static void parse_trace(trace_t *trace)
 {
     FILE *tracefile;
-    trace_t *trace;
     char type[MAXLINE];
-    int index, size;
+    int index;
+    size_t size;
     int max_index = 0;
-    int op_index;
-
-    if (verbose > 1)
-        printf("Reading tracefile: %s\n", filename);
+    long op_index;
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-        unix_error("malloc 1 failed in read_trace");
-
-    /* Read the trace file header */
-    strcpy(trace->filename, tracedir);
-    strcat(trace->filename, filename);
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
     fscanf(tracefile, "%d", &trace->weight);
     fscanf(tracefile, "%d", &trace->num_ids);
-    fscanf(tracefile, "%d", &trace->num_ops);
+    fscanf(tracefile, "%ld", &trace->num_ops);
     fscanf(tracefile, "%d", &trace->ignore_ranges);
 
-    if(trace->weight < 0 || trace->weight > 3) {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
-    }
-    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
-        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
-    }
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+    /* We'll store each request line in the trace in these arrays */
+    trace->map = NULL;
+    if ((trace->op_type = malloc(trace->num_ops * sizeof(*trace->op_type))) == NULL ||
+        (trace->op_index = malloc(trace->num_ops * sizeof(*trace->op_index))) == NULL ||
+        (trace->op_size = malloc(trace->num_ops * sizeof(*trace->op_size))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks =
-         (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
-
-    /* and, if we're debugging, the offset into the random data */
-    if ((trace->block_rand_base =
-         calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
-
-
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
         switch(type[0]) {
         case 'a':
-            fscanf(tracefile, "%d %d", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
+            fscanf(tracefile, "%d %zu", &index, &size);
+            trace->op_type[op_index] = ALLOC;
+            trace->op_index[op_index] = index;
+            trace->op_size[op_index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'r':
-            fscanf(tracefile, "%d %d", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
+            fscanf(tracefile, "%d %zu", &index, &size);
+            trace->op_type[op_index] = REALLOC;
+            trace->op_index[op_index] = index;
+            trace->op_size[op_index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'f':
             fscanf(tracefile, "%d", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
+            trace->op_type[op_index] = FREE;
+            trace->op_index[op_index] = index;
+            trace->op_size[op_index] = 0;
             break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
@@ -804,6 +1525,77 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory. Files named
+ *     *.repb are binary traces (repb.h), and are mapped rather than read.
+ */
+static trace_t *read_trace(stats_t *stats, const char *tracedir,
+                           const char *filename)
+{
+    trace_t *trace;
+    size_t len = strlen(filename);
+
+    if (verbose > 1)
+        printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+        unix_error("malloc 1 failed in read_trace");
+
+    /* Read the header and the requests, or with -S just the header */
+    strcpy(trace->filename, tracedir);
+    strcat(trace->filename, filename);
+    trace->stream = NULL;
+    trace->map = NULL;
+    trace->op_first = 0;
+    if (stream_traces) {
+        if ((trace->stream = tstream_open(trace->filename, &trace->weight,
+                                          &trace->num_ids, &trace->num_ops,
+                                          &trace->ignore_ranges)) == NULL)
+            unix_error("Could not open %s in read_trace", trace->filename);
+        trace->op_type = NULL;
+        trace->op_index = NULL;
+        trace->op_size = NULL;
+    }
+    else if (len > 5 && strcmp(filename + len - 5, ".repb") == 0)
+        map_trace(trace);
+    else
+        parse_trace(trace);
+
+    if(trace->weight < 0 || trace->weight > 3) {
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    }
+    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
+        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+    }
+
+    /* A streamed trace numbers its blocks by slot, and the arrays below
+       grow to the number of slots as the replay needs them */
+    trace->num_slots = stream_traces ? STREAM_SLOTS : trace->num_ids;
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+         (char **)calloc(trace->num_slots, sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+         (size_t *)calloc(trace->num_slots,  sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+
+    /* and, if we're debugging, the offset into the random data */
+    if ((trace->block_rand_base =
+         calloc(trace->num_slots, sizeof(*trace->block_rand_base))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+    /* and, if the replays touch the payloads, the set of live blocks */
+    trace->live = trace->live_pos = NULL;
+    if (touch_pct >= 0 &&
+        ((trace->live = malloc(trace->num_slots * sizeof(int))) == NULL ||
+         (trace->live_pos = malloc(trace->num_slots * sizeof(int))) == NULL))
+        unix_error("malloc 6 failed in read_trace");
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
@@ -818,21 +1610,95 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
  */
 static void reinit_trace(trace_t *trace)
 {
-    memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
-    memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
+    memset(trace->blocks, 0, trace->num_slots * sizeof(*trace->blocks));
+    memset(trace->block_sizes, 0, trace->num_slots * sizeof(*trace->block_sizes));
     /* block_rand_base is unused if size is zero */
+    trace->op_first = 0;
+}
+
+/*
+ * trace_begin - start a pass over the requests of the trace, and return
+ *     how many are in op_xxx (all of them, unless the trace is streamed)
+ */
+static long trace_begin(trace_t *trace)
+{
+    trace->op_first = 0;
+    if (trace->stream == NULL)
+        return trace->num_ops;
+    tstream_start(trace->stream);
+    return trace_next(trace);
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ * trace_next - move op_xxx on to the next chunk of a streamed trace, and
+ *     return how many requests it holds; 0 at the end of the trace
+ */
+static long trace_next(trace_t *trace)
+{
+    int nslots = trace->num_slots;
+    long n;
+
+    if (trace->stream == NULL)
+        return 0;
+    trace->op_first += (trace->op_type != NULL) ? trace->op_count : 0;
+    n = tstream_next(trace->stream, &trace->op_type, &trace->op_index,
+                     &trace->op_size, &nslots);
+    if (n == 0) {
+        trace->op_type = NULL;
+        trace->op_first = 0;
+        return 0;
+    }
+    trace->op_count = n;
+
+    /* the chunk may use new slots; grow the block arrays to match */
+    if (nslots > trace->num_slots) {
+        int old = trace->num_slots;
+        while (trace->num_slots < nslots)
+            trace->num_slots *= 2;
+        if ((trace->blocks = realloc(trace->blocks,
+                 trace->num_slots * sizeof(*trace->blocks))) == NULL ||
+            (trace->block_sizes = realloc(trace->block_sizes,
+                 trace->num_slots * sizeof(*trace->block_sizes))) == NULL ||
+            (trace->block_rand_base = realloc(trace->block_rand_base,
+                 trace->num_slots * sizeof(*trace->block_rand_base))) == NULL)
+            unix_error("realloc failed in trace_next");
+        if (trace->live != NULL) {
+            if ((trace->live = realloc(trace->live,
+                     trace->num_slots * sizeof(*trace->live))) == NULL ||
+                (trace->live_pos = realloc(trace->live_pos,
+                     trace->num_slots * sizeof(*trace->live_pos))) == NULL)
+                unix_error("realloc failed in trace_next");
+            memset(trace->live_pos + old, 0xff,
+                   (trace->num_slots - old) * sizeof(*trace->live_pos));
+        }
+        memset(trace->blocks + old, 0,
+               (trace->num_slots - old) * sizeof(*trace->blocks));
+        memset(trace->block_sizes + old, 0,
+               (trace->num_slots - old) * sizeof(*trace->block_sizes));
+    }
+    return n;
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points to,
+ *              all of which were allocated in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);
+    if (trace->stream != NULL) /* close, unmap or free the requests... */
+        tstream_close(trace->stream);
+    else if (trace->map != NULL)
+        munmap(trace->map, trace->map_size);
+    else {
+        free(trace->op_type);
+        free(trace->op_index);
+        free(trace->op_size);
+    }
+    free(trace->blocks);      /* ...the three block arrays... */
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->live);        /* ...the live set, if any... */
+    free(trace->live_pos);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -846,7 +1712,7 @@ static void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, range_t **ranges)
 {
-    int i;
+    long i, n;
     int index;
     size_t size;
     char *newp;
@@ -865,25 +1731,30 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-        index = trace->ops[i].index;
-        size = trace->ops[i].size;
+    FOR_EACH_OP(trace, i, n) {
+        index = trace->op_index[i];
+        size = trace->op_size[i];
 
         if(debug_mode == DBG_EXPENSIVE) {
             range_t *r;
 
             /* Let the students check their own heap */
-            mm_checkheap(verbose);
+            if(check_sampled == 0 || (trace->op_first + i) % CHECKHEAP_EVERY == 0)
+                mm_checkheap(verbose);
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
+            if(check_sampled > 0) {
+                check_sample(trace, i, *ranges, check_sampled);
+            } else {
+                r = (*ranges != NULL) ? (*ranges)->next[0] : NULL;
+                while(r) {
+                    check_index(trace, i, r->index);
+                    r = r->next[0];
+                }
             }
         }
 
-        switch (trace->ops[i].type) {
+        switch (trace->op_type[i]) {
 
         case ALLOC: /* mm_malloc */
 
@@ -983,30 +1854,43 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  *   is always the high water mark of the heap.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   With -R, the heap is also scored against what it costs in memory:
+ *   the pages resident at the peak, sampled RSS_SAMPLES times over the
+ *   trace. The payload of every block is touched, as the program that
+ *   made the requests would have done, and the heap starts out purged.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
-    int i;
+    long i, n;
     int index;
-    int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t size, newsize, oldsize;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
+    long sample_every = trace->num_ops / RSS_SAMPLES + 1;
     char *p;
     char *newp, *oldp;
+    FILE *timeline = NULL;
 
     reinit_trace(trace);
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
+    if (rss_util)
+        mem_purge();
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
+    if (locality)
+        locality_start(mem_heap_lo());
+    if (timeline_every > 0)
+        timeline = timeline_open(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    FOR_EACH_OP(trace, i, n) {
+        switch (trace->op_type[i]) {
 
         case ALLOC: /* mm_alloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = trace->op_index[i];
+            size = trace->op_size[i];
 
             if ((p = mm_malloc(size)) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
@@ -1016,13 +1900,17 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             /* Remember region and size */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
+            if (rss_util)
+                touch_pages(p, size);
+            if (locality)
+                locality_alloc(p, size);
 
             total_size += size;
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = trace->op_index[i];
+            newsize = trace->op_size[i];
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
@@ -1034,12 +1922,16 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             /* Remember region and size */
             trace->blocks[index] = newp;
             trace->block_sizes[index] = newsize;
+            if (rss_util)
+                touch_pages(newp, newsize);
+            if (locality)
+                locality_realloc(oldp, oldsize, newp, newsize);
 
             total_size += (newsize - oldsize);
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = trace->op_index[i];
             if(index < 0) {
                 size = 0;
                 p = 0;
@@ -1048,6 +1940,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
+            if (locality)
+                locality_free(p, size);
             mm_free(p);
 
             total_size -= size;
@@ -1059,15 +1953,144 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         }
 
         /* update the high-water mark */
-        max_total_size = (total_size > max_total_size) ?
-            total_size : max_total_size;
+        if (total_size > max_total_size) {
+            max_total_size = total_size;
+            stats->peak_op = trace->op_first + i;
+        }
+
+        if (rss_util && (trace->op_first + i) % sample_every == 0)
+            mem_resident_pages();
+        if (timeline != NULL && (trace->op_first + i + 1) % timeline_every == 0)
+            timeline_sample(timeline, trace->op_first + i + 1, total_size);
+    }
+
+    if (timeline != NULL) {
+        if (trace->num_ops % timeline_every != 0)
+            timeline_sample(timeline, trace->num_ops, total_size);
+        if (fclose(timeline) != 0)
+            unix_error("Could not write the timeline of %s", trace->filename);
     }
 
     printf(".");
 
+    if (locality)
+        locality_stop(&stats->loc);
+
+    if (rss_util) {
+        stats->final_pages = mem_resident_pages();
+        stats->peak_pages = mem_peak_resident_pages();
+        stats->rss_util = stats->peak_pages == 0 ? 0 :
+            (double)max_total_size / ((double)stats->peak_pages * mem_pagesize());
+    }
+
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
+/*
+ * touch_pages - Write to every page of the payload [p, p+size), so that
+ *    it counts as resident the way it would in a real program
+ */
+static void touch_pages(char *p, size_t size)
+{
+    size_t page = mem_pagesize();
+    char *q;
+
+    if (size == 0)
+        return;
+    p[0] = 0;
+    for (q = (char *)(((unsigned long)p | (page - 1)) + 1); q < p + size; q += page)
+        *q = 0;
+}
+
+/*
+ * The application model (-T). The speed replays then do what the program
+ * behind the trace would: write each new payload, one store per cache
+ * line, and before touch_pct% of the requests read back a random live
+ * block. The misses these take depend on where the allocator put the
+ * blocks, so they count in its throughput. The random choices come from
+ * a generator reseeded for each replay, so every run, and libc malloc
+ * too, reads the same blocks.
+ */
+#define APP_LINE 64   /* bytes apart of the accesses to a payload */
+
+static unsigned long long app_seed;
+static volatile unsigned long app_sink;
+
+/*
+ * app_begin - start a replay of the trace with no live blocks
+ */
+static void app_begin(trace_t *trace)
+{
+    trace->num_live = 0;
+    memset(trace->live_pos, 0xff, trace->num_slots * sizeof(*trace->live_pos));
+    app_seed = 88172645463325252ULL;
+}
+
+/*
+ * app_alloc - block index is now the size-byte payload p (NULL for a
+ *     realloc to 0); write the bytes that are new to it
+ */
+static void app_alloc(trace_t *trace, int index, char *p, size_t size)
+{
+    size_t off;
+
+    if (p == NULL) {
+        app_free(trace, index);
+        return;
+    }
+    off = 0;
+    if (trace->live_pos[index] >= 0)   /* realloc copied the old bytes */
+        off = trace->block_sizes[index];
+    else {
+        trace->live_pos[index] = trace->num_live;
+        trace->live[trace->num_live++] = index;
+    }
+    for (; off < size; off += APP_LINE)
+        p[off] = (char)off;
+    trace->block_sizes[index] = size;
+}
+
+/*
+ * app_free - block index is about to be freed
+ */
+static void app_free(trace_t *trace, int index)
+{
+    int pos;
+
+    if (index < 0 || (pos = trace->live_pos[index]) < 0)
+        return;
+    trace->live[pos] = trace->live[--trace->num_live];
+    trace->live_pos[trace->live[pos]] = pos;
+    trace->live_pos[index] = -1;
+}
+
+/*
+ * app_read - with probability touch_pct%, read every line of a random
+ *     live block
+ */
+static void app_read(trace_t *trace)
+{
+    unsigned long long x;
+    unsigned long sum = 0;
+    size_t off, size;
+    const char *p;
+    int index;
+
+    x = app_seed;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    app_seed = x;
+    if (trace->num_live == 0 || (int)(x % 100) >= touch_pct)
+        return;
+    index = trace->live[(x >> 8) % trace->num_live];
+    p = trace->blocks[index];
+    size = trace->block_sizes[index];
+    for (off = 0; off < size; off += APP_LINE)
+        sum += p[off];
+    app_sink = sum;
+}
+
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -1075,7 +2098,9 @@ static double eval_mm_util(trace_t *trace, int tracenum)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    long i, n;
+    int index;
+    size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
@@ -1084,41 +2109,541 @@ static void eval_mm_speed(void *ptr)
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_speed");
+    if (touch_pct >= 0)
+        app_begin(trace);
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
+    FOR_EACH_OP(trace, i, n) {
+        if (touch_pct > 0)
+            app_read(trace);
+        switch (trace->op_type[i]) {
 
         case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = trace->op_index[i];
+            size = trace->op_size[i];
             if ((p = mm_malloc(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            if (touch_pct >= 0)
+                app_alloc(trace, index, p, size);
             break;
 
         case REALLOC: /* mm_realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = trace->op_index[i];
+            newsize = trace->op_size[i];
             oldp = trace->blocks[index];
             if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
                 app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            if (touch_pct >= 0)
+                app_alloc(trace, index, newp, newsize);
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+            index = trace->op_index[i];
             if(index < 0) {
                 block = 0;
             } else {
                 block = trace->blocks[index];
             }
+            if (touch_pct >= 0)
+                app_free(trace, index);
             mm_free(block);
             break;
 
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
+    }
+}
+
+/*
+ * purge_heap - Called by fcyc before each run of eval_mm_speed when the
+ *    cold heap is timed, to give back every page the last run touched
+ */
+static void purge_heap(void *ptr __attribute__((unused)))
+{
+    mem_purge();
+}
+
+/*
+ * replay_op - Make request i of the trace to the mm package, for the
+ *    replays that only measure the allocator (-p, -L, -M, -a). The
+ *    block and its payload size are recorded, and a freed block is
+ *    cleared, so a pass can look at the live blocks after any request.
+ */
+static void replay_op(trace_t *trace, long i, int tracenum, const char *who)
+{
+    int index = trace->op_index[i];
+    size_t size = trace->op_size[i];
+    char *p;
+
+    switch (trace->op_type[i]) {
+    case ALLOC: /* mm_malloc */
+        if ((p = mm_malloc(size)) == NULL)
+            app_error("trace %d: mm_malloc failed in %s", tracenum, who);
+        trace->blocks[index] = p;
+        trace->block_sizes[index] = size;
+        break;
+
+    case REALLOC: /* mm_realloc */
+        p = mm_realloc(trace->blocks[index], size);
+        if (p == NULL && size != 0)
+            app_error("trace %d: mm_realloc failed in %s", tracenum, who);
+        trace->blocks[index] = p;
+        trace->block_sizes[index] = size;
+        break;
+
+    case FREE: /* mm_free */
+        if (index >= 0) {
+            mm_free(trace->blocks[index]);
+            trace->blocks[index] = NULL;
+        } else
+            mm_free(NULL);
+        break;
+
+    default:
+        app_error("trace %d: Nonexistent request type in %s", tracenum, who);
+    }
+}
+
+/*
+ * eval_mm_sim - Replay the trace once more on a fresh heap, passing
+ *    every heap metadata load and store the allocator makes to the cache
+ *    simulator (-M). The misses depend only on the allocator and the
+ *    trace, not on the machine or what else it is running.
+ */
+static void eval_mm_sim(trace_t *trace, int tracenum, stats_t *stats)
+{
+    long i, n;
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("trace %d: mm_init failed in eval_mm_sim", tracenum);
+
+    cachesim_reset(mem_heap_lo());
+    mm_sim.access = cachesim_access;
+    mm_sim.enabled = 1;
+    FOR_EACH_OP(trace, i, n)
+        replay_op(trace, i, tracenum, "eval_mm_sim");
+    mm_sim.enabled = 0;
+    cachesim_counts(&stats->sim_accesses, stats->sim_misses);
+}
+
+/*
+ * eval_mm_events - Count hardware events (-E) over one more replay of
+ *    the trace, on the heap the speed runs left warm. Each event has a
+ *    counter of its own, all counting the same replay; an event that
+ *    cannot be counted here is left at -1.
+ */
+static void eval_mm_events(speed_t *speed_params, stats_t *stats)
+{
+    int ctr[PERFCTR_NEVENTS];
+    int e;
+
+    for (e = 0; e < PERFCTR_NEVENTS; e++) {
+        ctr[e] = perfctr_open(e);
+        stats->events[e] = -1;
+    }
+    for (e = 0; e < PERFCTR_NEVENTS; e++)
+        if (ctr[e] >= 0)
+            perfctr_start(ctr[e]);
+    eval_mm_speed(speed_params);
+    for (e = 0; e < PERFCTR_NEVENTS; e++) {
+        if (ctr[e] >= 0) {
+            stats->events[e] = perfctr_stop(ctr[e]);
+            perfctr_close(ctr[e]);
+        }
+    }
+}
+
+/*
+ * flush_caches - Called by fcyc before each cold timed run with -z,
+ *    instead of reading through twice the last-level cache: evicts the
+ *    heap and the trace's arrays from every cache level with clflush,
+ *    so that only the data the replay itself uses starts cold
+ */
+static void flush_caches(void *ptr)
+{
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    long n = (trace->stream != NULL) ? trace->op_count : trace->num_ops;
+
+    fcyc_flush_range(mem_heap_lo(), mem_heapsize());
+    fcyc_flush_range(trace->op_type, n * sizeof(*trace->op_type));
+    fcyc_flush_range(trace->op_index, n * sizeof(*trace->op_index));
+    fcyc_flush_range(trace->op_size, n * sizeof(*trace->op_size));
+    fcyc_flush_range(trace->blocks, trace->num_slots * sizeof(*trace->blocks));
+    fcyc_flush_range(trace->block_sizes,
+                     trace->num_slots * sizeof(*trace->block_sizes));
+}
+
+/*
+ * eval_mm_prof - Replay the trace once more with the allocator's
+ *    instrumentation turned on. Each request is timed on its own and
+ *    its cost split across the allocator's internal phases, so that a
+ *    slow trace can be traced back to long free-list searches, heavy
+ *    coalescing or heap extension. Prints a histogram of the number of
+ *    free-list nodes visited per mm_malloc, the per-phase totals, and
+ *    the prof_slowest most expensive requests.
+ */
+static void eval_mm_prof(trace_t *trace, int tracenum)
+{
+    static const char *phase_names[MM_NPHASES] = {
+        "search", "split", "coalesce", "extend"
+    };
+    static const char *type_names[] = { "a", "f", "r" };
+    unsigned long hist[PROF_BUCKETS];
+    unsigned long long totals[MM_NPHASES];
+    unsigned long long total_cycles = 0;
+    unsigned long mallocs = 0;
+    opcost_t *slowest;
+    opcost_t cost;
+    unsigned long long other;
+    char label[32];
+    int nslowest = 0;
+    long i, n;
+    int j, b;
+
+    if ((slowest = calloc(prof_slowest, sizeof(opcost_t))) == NULL)
+        unix_error("calloc failed in eval_mm_prof");
+    memset(hist, 0, sizeof(hist));
+    memset(totals, 0, sizeof(totals));
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("trace %d: mm_init failed in eval_mm_prof", tracenum);
+
+    mm_prof.enabled = 1;
+    FOR_EACH_OP(trace, i, n) {
+        mm_prof.visited = 0;
+        memset(mm_prof.cycles, 0, sizeof(mm_prof.cycles));
+        cost.cycles = read_counter();
+        replay_op(trace, i, tracenum, "eval_mm_prof");
+        cost.cycles = read_counter() - cost.cycles;
+        cost.opnum = trace->op_first + i;
+        cost.type = trace->op_type[i];
+        cost.size = trace->op_size[i];
+        cost.visited = mm_prof.visited;
+        memcpy(cost.phase, mm_prof.cycles, sizeof(cost.phase));
+
+        total_cycles += cost.cycles;
+        for (j = 0; j < MM_NPHASES; j++)
+            totals[j] += cost.phase[j];
+
+        /* bucket b holds search lengths in [2^(b-1), 2^b) */
+        if (trace->op_type[i] == ALLOC) {
+            for (b = 0; b < PROF_BUCKETS - 1 && (cost.visited >> b) != 0; b++)
+                ;
+            hist[b]++;
+            mallocs++;
+        }
+
+        /* keep the slowest requests, sorted by decreasing cost */
+        if (nslowest < prof_slowest)
+            nslowest++;
+        else if (cost.cycles <= slowest[nslowest-1].cycles)
+            continue;
+        for (j = nslowest - 1; j > 0 && slowest[j-1].cycles < cost.cycles; j--)
+            slowest[j] = slowest[j-1];
+        slowest[j] = cost;
+    }
+    mm_prof.enabled = 0;
+
+    printf("\nProfile for %s:\n", trace->filename);
+    printf("  %-14s%10s%8s\n", "nodes/malloc", "count", "pct");
+    for (b = 0; b < PROF_BUCKETS; b++) {
+        if (hist[b] == 0)
+            continue;
+        if (b <= 1)
+            snprintf(label, sizeof(label), "%d", b);
+        else if (b == PROF_BUCKETS - 1)
+            snprintf(label, sizeof(label), "%lu+", 1UL << (b-1));
+        else
+            snprintf(label, sizeof(label), "%lu-%lu", 1UL << (b-1),
+                     (1UL << b) - 1);
+        printf("  %-14s%10lu%7.1f%%\n", label, hist[b],
+               100.0 * hist[b] / mallocs);
+    }
+
+    printf("  %-14s%10s%8s\n", "phase", "cycles", "pct");
+    for (j = 0; j < MM_NPHASES; j++) {
+        printf("  %-14s%10llu%7.1f%%\n", phase_names[j], totals[j],
+               total_cycles ? 100.0 * totals[j] / total_cycles : 0.0);
+    }
+
+    printf("  %d slowest requests:\n", nslowest);
+    printf("  %6s %2s%10s%10s%8s", "line", "op", "size", "cycles", "nodes");
+    for (j = 0; j < MM_NPHASES; j++)
+        printf("%10s", phase_names[j]);
+    printf("%10s\n", "other");
+    for (i = 0; i < nslowest; i++) {
+        printf("  %6ld %2s%10zu%10llu%8lu", LINENUM(slowest[i].opnum),
+               type_names[slowest[i].type], slowest[i].size,
+               slowest[i].cycles, slowest[i].visited);
+        other = slowest[i].cycles;
+        for (j = 0; j < MM_NPHASES; j++) {
+            printf("%10llu", slowest[i].phase[j]);
+            other -= (other < slowest[i].phase[j]) ? other : slowest[i].phase[j];
+        }
+        printf("%10llu\n", other);
+    }
+
+    free(slowest);
+}
+
+/*
+ * counter_overhead - The fewest cycles between two back-to-back reads
+ *    of the serialized counter: what timing a request adds to it
+ */
+static unsigned long long counter_overhead(void)
+{
+    unsigned long long t, best = ~0ULL;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        t = read_counter_serial();
+        t = read_counter_serial() - t;
+        if (t < best)
+            best = t;
+    }
+    return best;
+}
+
+/*
+ * eval_mm_latency - Replay the trace once more, on the heap the speed
+ *    runs left warm, timing each request on its own between two
+ *    serialized counter reads. The cost of the reads is measured first
+ *    and taken off every request. Each request type gets a histogram,
+ *    from which stats keeps the percentiles and the slowest requests.
+ */
+static void eval_mm_latency(trace_t *trace, int tracenum, stats_t *stats)
+{
+    static hdrhist_t hist[3];
+    static unsigned long long worst_cycles[3][LAT_WORST];
+    unsigned long long start, cycles, ovhd;
+    lat_t *lat;
+    long i, n;
+    int j, type;
+
+    for (type = 0; type < 3; type++)
+        hdrhist_reset(&hist[type]);
+    memset(stats->lat, 0, sizeof(stats->lat));
+    ovhd = counter_overhead();
+    stats->lat_overhead = ovhd;
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("trace %d: mm_init failed in eval_mm_latency", tracenum);
+
+    FOR_EACH_OP(trace, i, n) {
+        type = trace->op_type[i];
+        start = read_counter_serial();
+        replay_op(trace, i, tracenum, "eval_mm_latency");
+        cycles = read_counter_serial() - start;
+        cycles = (cycles > ovhd) ? cycles - ovhd : 0;
+
+        hdrhist_record(&hist[type], cycles);
+
+        /* keep the slowest requests, sorted by decreasing cost */
+        lat = &stats->lat[type];
+        if (lat->nworst < LAT_WORST)
+            lat->nworst++;
+        else if (cycles <= worst_cycles[type][lat->nworst-1])
+            continue;
+        for (j = lat->nworst - 1; j > 0 && worst_cycles[type][j-1] < cycles; j--) {
+            worst_cycles[type][j] = worst_cycles[type][j-1];
+            lat->worst[j] = lat->worst[j-1];
+        }
+        worst_cycles[type][j] = cycles;
+        lat->worst[j] = trace->op_first + i;
+    }
+
+    for (type = 0; type < 3; type++) {
+        lat = &stats->lat[type];
+        lat->count = hist[type].count;
+        lat->p50 = hdrhist_percentile(&hist[type], 50.0);
+        lat->p99 = hdrhist_percentile(&hist[type], 99.0);
+        lat->p999 = hdrhist_percentile(&hist[type], 99.9);
+        lat->max = hist[type].max;
+    }
+}
+
+/*
+ * eval_mm_faults - Replay the trace once on a heap that has never been
+ *    touched, as the speed runs' heap has, counting the minor page faults
+ *    taken and the heap pages touched. Comparing the time of this cold
+ *    replay with the warm speed runs shows the first-touch cost apart
+ *    from the allocator's own work.
+ */
+static void eval_mm_faults(speed_t *speed_params, stats_t *stats)
+{
+    struct rusage before, after;
+    mem_ctx_t *ctx, *prev;
+
+    if ((ctx = mem_ctx_create(max_heap)) == NULL)
+        unix_error("mem_ctx_create failed in eval_mm_faults");
+    prev = mem_ctx_bind(ctx);
+
+    getrusage(RUSAGE_SELF, &before);
+    stats->cold_secs = ftimer_gettod(eval_mm_speed, speed_params, 1);
+    getrusage(RUSAGE_SELF, &after);
+
+    stats->minflt = after.ru_minflt - before.ru_minflt;
+    stats->pages = mem_resident_pages();
+
+    mem_ctx_destroy(ctx);
+    mem_ctx_bind(prev);
+}
+
+/*
+ * eval_mm_pages - Measure the trace on a heap of small pages and on one
+ *    of huge pages: the throughput, by the usual K-best scheme, and the
+ *    dTLB misses of one replay. Both heaps are faulted in first, so
+ *    that only the translation cost differs.
+ */
+static void eval_mm_pages(speed_t *speed_params, stats_t *stats)
+{
+    static const int modes[2] = { MEM_PAGES_SMALL, -1 };
+    mem_ctx_t *ctx, *prev;
+    int i, ctr, mode;
+
+    ctr = perfctr_open(PERFCTR_DTLB_MISSES);
+    for (i = 0; i < 2; i++) {
+        mode = (modes[i] < 0) ? huge_pages : modes[i];
+        mem_set_page_mode(mode);
+        if ((ctx = mem_ctx_create(max_heap)) == NULL)
+            unix_error("mem_ctx_create failed in eval_mm_pages");
+        prev = mem_ctx_bind(ctx);
+        if (i == 1)
+            stats->page_mode = mem_page_mode();
+
+        eval_mm_speed(speed_params);
+        stats->dtlb[i] = -1;
+        if (ctr >= 0) {
+            perfctr_start(ctr);
+            eval_mm_speed(speed_params);
+            stats->dtlb[i] = perfctr_stop(ctr);
+        }
+        stats->page_secs[i] = fsecs(eval_mm_speed, speed_params);
+
+        mem_ctx_destroy(ctx);
+        mem_ctx_bind(prev);
+    }
+    if (ctr >= 0)
+        perfctr_close(ctr);
+    mem_set_page_mode(huge_pages);
+}
+
+/*
+ * dump_heap_profile - Write the heap profile gathered while replaying
+ *    the trace to <trace basename>.heap in the current directory
+ */
+static void dump_heap_profile(const trace_t *trace)
+{
+    char path[MAXLINE + 8];
+    const char *base = strrchr(trace->filename, '/');
+
+    base = (base == NULL) ? trace->filename : base + 1;
+    snprintf(path, sizeof(path), "%s.heap", base);
+    if (heapprof_dump(path) < 0)
+        unix_error("Could not write heap profile %s", path);
+    if (verbose > 1)
+        printf("Wrote heap profile %s\n", path);
+}
+
+/*
+ * The fragmentation timeline (-i). Every timeline_every requests the
+ * utilization run walks the heap and writes a line of
+ * <trace basename>.timeline.csv in the current directory: the requests
+ * done, the live payload bytes, the heap size, and the free bytes, the
+ * largest free block and the number of free blocks.
+ */
+typedef struct {
+    size_t free_bytes, largest;
+    long free_blocks;
+} frag_t;
+
+/* Walk callback: add the block to the frag_t at arg if it is free */
+static void frag_visit(void *bp __attribute__((unused)), size_t size,
+                       int alloc, void *arg)
+{
+    frag_t *frag = arg;
+
+    if (alloc)
+        return;
+    frag->free_bytes += size;
+    frag->free_blocks++;
+    if (size > frag->largest)
+        frag->largest = size;
+}
+
+/*
+ * timeline_open - Create the timeline file for trace and write its header
+ */
+static FILE *timeline_open(const trace_t *trace)
+{
+    char path[MAXLINE + 16];
+    const char *base = strrchr(trace->filename, '/');
+    FILE *f;
+
+    base = (base == NULL) ? trace->filename : base + 1;
+    snprintf(path, sizeof(path), "%s.timeline.csv", base);
+    if ((f = fopen(path, "w")) == NULL)
+        unix_error("Could not create timeline %s", path);
+    if (verbose > 1)
+        printf("Writing timeline %s\n", path);
+    fprintf(f, "op,live,heap,free,largest_free,free_blocks\n");
+    return f;
+}
+
+/*
+ * timeline_sample - Walk the heap and write its line for ops requests done
+ *     with live payload bytes allocated
+ */
+static void timeline_sample(FILE *f, long ops, size_t live)
+{
+    frag_t frag = { 0, 0, 0 };
+
+    mm_heapwalk(frag_visit, &frag);
+    fprintf(f, "%ld,%zu,%zu,%zu,%zu,%ld\n", ops, live, mem_heapsize(),
+            frag.free_bytes, frag.largest, frag.free_blocks);
+}
+
+/*
+ * eval_mm_waste - Replay the trace once more on a fresh heap and, right
+ *    after the request at which the utilization run saw the live bytes
+ *    peak, break the heap down (-a): mm_block_waste splits each live
+ *    block into payload, headers and footers, alignment and minimum-block
+ *    padding and unsplit remainder; the heap walk adds up the free
+ *    blocks; the rest of the heap is the allocator's own structure.
+ */
+static void eval_mm_waste(trace_t *trace, int tracenum, stats_t *stats)
+{
+    long i, n;
+    int index;
+    frag_t frag = { 0, 0, 0 };
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("trace %d: mm_init failed in eval_mm_waste", tracenum);
+
+    memset(&stats->waste, 0, sizeof(stats->waste));
+    FOR_EACH_OP(trace, i, n) {
+        replay_op(trace, i, tracenum, "eval_mm_waste");
+        if (trace->op_first + i != stats->peak_op)
+            continue;
+        for (index = 0; index < trace->num_slots; index++)
+            if (trace->blocks[index] != NULL)
+                mm_block_waste(trace->blocks[index],
+                               trace->block_sizes[index], &stats->waste);
+        mm_heapwalk(frag_visit, &frag);
+        stats->waste_free = frag.free_bytes;
+        stats->waste_heap = mem_heapsize();
+    }
 }
 
 /*
@@ -1129,35 +2654,36 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace)
 {
-    int i, newsize;
+    long i, n;
+    size_t newsize;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    FOR_EACH_OP(trace, i, n) {
+        switch (trace->op_type[i]) {
 
         case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
+            if ((p = malloc(trace->op_size[i])) == NULL) {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = p;
+            trace->blocks[trace->op_index[i]] = p;
             break;
 
         case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[trace->ops[i].index];
+            newsize = trace->op_size[i];
+            oldp = trace->blocks[trace->op_index[i]];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0) {
                 malloc_error(trace, i, "libc realloc failed");
                 unix_error("System message");
             }
-            trace->blocks[trace->ops[i].index] = newp;
+            trace->blocks[trace->op_index[i]] = newp;
             break;
 
         case FREE: /* free */
-            if(trace->ops[i].index >= 0) {
-                free(trace->blocks[trace->ops[i].index]);
+            if(trace->op_index[i] >= 0) {
+                free(trace->blocks[trace->op_index[i]]);
             } else {
                 free(0);
             }
@@ -1178,37 +2704,48 @@ static int eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
-    int index, size, newsize;
+    long i, n;
+    int index;
+    size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     reinit_trace(trace);
+    if (touch_pct >= 0)
+        app_begin(trace);
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    FOR_EACH_OP(trace, i, n) {
+        if (touch_pct > 0)
+            app_read(trace);
+        switch (trace->op_type[i]) {
         case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
+            index = trace->op_index[i];
+            size = trace->op_size[i];
             if ((p = malloc(size)) == NULL)
                 unix_error("malloc failed in eval_libc_speed");
             trace->blocks[index] = p;
+            if (touch_pct >= 0)
+                app_alloc(trace, index, p, size);
             break;
 
         case REALLOC: /* realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            index = trace->op_index[i];
+            newsize = trace->op_size[i];
             oldp = trace->blocks[index];
             if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
                 unix_error("realloc failed in eval_libc_speed\n");
 
             trace->blocks[index] = newp;
+            if (touch_pct >= 0)
+                app_alloc(trace, index, newp, newsize);
             break;
 
         case FREE: /* free */
-            index = trace->ops[i].index;
+            index = trace->op_index[i];
             if(index >= 0) {
                 block = trace->blocks[index];
+                if (touch_pct >= 0)
+                    app_free(trace, index);
                 free(block);
             } else {
                 free(0);
@@ -1231,16 +2768,20 @@ static void printresults(int n, stats_t *stats)
     int i;
     /* weighted sums all */
     double sumsecs = 0;
+    double sumwarm = 0;
     double sumops  = 0;
     double sumutil = 0;
+    double sumrss = 0;
     int sum_perf_weight = 0;
     int sum_util_weight = 0;
 
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s", "valid", "util");
+    if (rss_util)
+        printf("%7s", "rss");
+    printf(" %5s%8s%9s%6s  %s\n", "ops", "secs", "Kops", "warm", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1274,13 +2815,23 @@ static void printresults(int n, stats_t *stats)
             else
                 printf(" %6s", "--");
 
+            /* the resident page count is only measured for mm malloc */
+            if (rss_util) {
+                if (stats[i].peak_pages > 0 && (stats[i].weight == WNONE
+                    || stats[i].weight == WALL || stats[i].weight == WUTIL))
+                    printf(" %5.0f%%", stats[i].rss_util * 100.0);
+                else
+                    printf(" %6s", "--");
+            }
+
             /* print '--' if perf isn't weighted */
             if(stats[i].weight == WNONE || stats[i].weight == WALL
                || stats[i].weight == WPERF)
-                printf("%8.0f%10.6f%6.0f", stats[i].ops, stats[i].secs,
-                       (stats[i].ops/1e3)/stats[i].secs);
+                printf("%8.0f%10.6f%6.0f%6.0f", stats[i].ops, stats[i].secs,
+                       (stats[i].ops/1e3)/stats[i].secs,
+                       (stats[i].ops/1e3)/stats[i].warm_secs);
             else
-                printf("%8s%10s%6s", "--", "--", "--");
+                printf("%8s%10s%6s%6s", "--", "--", "--", "--");
 
             printf(" %s\n", stats[i].filename);
 
@@ -1288,23 +2839,21 @@ static void printresults(int n, stats_t *stats)
                 {
                     sum_perf_weight += 1;
                     sumsecs += stats[i].secs;
+                    sumwarm += stats[i].warm_secs;
                     sumops += stats[i].ops;
                 }
             if(stats[i].weight == WALL || stats[i].weight == WUTIL)
                 {
                     sum_util_weight += 1;
                     sumutil += stats[i].util;
+                    sumrss += stats[i].rss_util;
                 }
         }
         else {
-            printf("%2s%4s %6s%8s%10s%6s %s\n",
-                   stats[i].weight != 0 ? "*" : "",
-                   "no",
-                   "-",
-                   "-",
-                   "-",
-                   "-",
-                   stats[i].filename);
+            printf("%2s%4s %6s", stats[i].weight != 0 ? "*" : "", "no", "-");
+            if (rss_util)
+                printf(" %6s", "-");
+            printf("%8s%10s%6s%6s %s\n", "-", "-", "-", "-", stats[i].filename);
         }
     }
 
@@ -1313,16 +2862,19 @@ static void printresults(int n, stats_t *stats)
         if(sum_perf_weight == 0) sum_perf_weight = 1;
         if(sum_util_weight == 0) sum_util_weight = 1;
 
-        printf("%2d %2d  %5.0f%%%8.0f%10.6f%6.0f\n",
-               sum_util_weight,
-               sum_perf_weight,
-               (sumutil/(double)sum_util_weight)*100.0,
+        printf("%2d %2d  %5.0f%%", sum_util_weight, sum_perf_weight,
+               (sumutil/(double)sum_util_weight)*100.0);
+        if (rss_util)
+            printf(" %5.0f%%", (sumrss/(double)sum_util_weight)*100.0);
+        printf("%8.0f%10.6f%6.0f%6.0f\n",
                sumops,
                sumsecs,
-               (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs);
+               (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs,
+               (sumwarm==0.0) ? 0 : (sumops/1e3)/sumwarm);
     }
     else {
-        printf("     %8s%10s%6s\n",
+        printf("     %8s%10s%6s%6s\n",
+               "-",
                "-",
                "-",
                "-");
@@ -1330,6 +2882,101 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printfaults - prints the page fault counts gathered by eval_mm_faults,
+ *     with the time of the cold replay next to the warm (measured) time
+ */
+static void printfaults(int n, stats_t *stats)
+{
+    int i;
+
+    printf("  %9s%8s%10s%10s  %s\n",
+           "faults", "pages", "cold secs", "warm secs", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %9ld%8zu%10.6f%10.6f  %s\n", stats[i].minflt,
+               stats[i].pages, stats[i].cold_secs, stats[i].secs,
+               stats[i].filename);
+    }
+}
+
+/*
+ * printrss - prints the resident heap pages measured by eval_mm_util
+ */
+static void printrss(int n, stats_t *stats)
+{
+    int i;
+
+    printf("  %9s%9s%10s  %s\n", "peak", "final", "peak KB", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %9zu%9zu%10zu  %s\n", stats[i].peak_pages,
+               stats[i].final_pages,
+               stats[i].peak_pages * mem_pagesize() / 1024,
+               stats[i].filename);
+    }
+}
+
+/*
+ * printpages - prints the small vs huge page measurements made by
+ *     eval_mm_pages. The huge column is headed by the pages the heap
+ *     actually got, which may be a fallback.
+ */
+static void printpages(int n, stats_t *stats)
+{
+    static const char *names[] = { "4K", "thp", "hugetlb" };
+    char head[2][32];
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        snprintf(head[0], sizeof(head[0]), "%s", names[MEM_PAGES_SMALL]);
+        snprintf(head[1], sizeof(head[1]), "%s", names[stats[i].page_mode]);
+        printf("  %8s %-4s%12s %-7s%8s %-4s%12s %-7s  %s\n",
+               "Kops", head[0], "dTLB-misses", head[0],
+               "Kops", head[1], "dTLB-misses", head[1], "trace");
+        break;
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf(" ");
+        for (j = 0; j < 2; j++) {
+            printf("%9.0f     ", (stats[i].ops/1e3)/stats[i].page_secs[j]);
+            if (stats[i].dtlb[j] >= 0)
+                printf("%12lld        ", stats[i].dtlb[j]);
+            else
+                printf("%12s        ", "n/a");
+        }
+        printf("%s%s\n", stats[i].filename,
+               stats[i].page_mode == huge_pages ? "" : " (fallback)");
+    }
+}
+
+/*
+ * printwarmth - prints the throughput on the prefaulted (warm) heap
+ *     next to that on a heap purged before every run (cold)
+ */
+static void printwarmth(int n, stats_t *stats)
+{
+    int i;
+
+    printf("  %10s%10s%10s  %s\n", "warm Kops", "cold Kops", "cold/warm",
+           "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %10.0f%10.0f%10.2f  %s\n",
+               (stats[i].ops/1e3)/stats[i].secs,
+               (stats[i].ops/1e3)/stats[i].cold_heap_secs,
+               stats[i].secs/stats[i].cold_heap_secs,
+               stats[i].filename);
+    }
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1356,29 +3003,242 @@ void unix_error(const char *fmt, ...) {
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+void malloc_error(const trace_t *trace, long opnum, const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
 
     errors++;
 
-    printf("ERROR [trace %s, line %d]: ", trace->filename, LINENUM(opnum));
+    printf("ERROR [trace %s, line %ld]: ", trace->filename,
+           LINENUM(trace->op_first + opnum));
     vprintf(fmt, ap);
     putchar('\n');
 
     va_end(ap);
 }
 
+/*
+ * printlatency - prints the latency percentiles measured by
+ *     eval_mm_latency for each request type, with the trace lines of
+ *     the slowest requests
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *type_names[] = { "malloc", "free", "realloc" };
+    const lat_t *lat;
+    int i, j, type;
+
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %s (less %llu for the timer)\n", stats[i].filename,
+               stats[i].lat_overhead);
+        printf("    %-8s%10s%9s%9s%9s%10s  %s\n", "op", "count", "p50",
+               "p99", "p99.9", "max", "slowest (line)");
+        for (type = 0; type < 3; type++) {
+            lat = &stats[i].lat[type];
+            if (lat->count == 0)
+                continue;
+            printf("    %-8s%10llu%9llu%9llu%9llu%10llu ",
+                   type_names[type], lat->count, lat->p50, lat->p99,
+                   lat->p999, lat->max);
+            for (j = 0; j < lat->nworst; j++)
+                printf(" %ld", LINENUM(lat->worst[j]));
+            printf("\n");
+        }
+    }
+}
+
+/*
+ * printspread - prints how far apart the timed runs of each trace were:
+ *     the fastest (which secs reports), the median, and the standard
+ *     deviation relative to the median. A '!' marks a trace whose K
+ *     fastest runs never agreed, whose time is likely noise.
+ */
+static void printspread(int n, stats_t *stats)
+{
+    int i;
+
+    printf("  %7s%11s%11s%8s   %s\n", "samples", "min secs", "median",
+           "stddev", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].nsamples == 0)
+            continue;
+        printf("  %7d%11.6f%11.6f%7.1f%% %s %s\n", stats[i].nsamples,
+               stats[i].min_secs, stats[i].median_secs,
+               100.0 * stats[i].stddev_secs / stats[i].median_secs,
+               stats[i].converged ? " " : "!", stats[i].filename);
+    }
+}
+
+/*
+ * printevents - prints the hardware events counted by eval_mm_events,
+ *     per request, with the instructions per cycle. The last line is
+ *     over all the traces that counted the event.
+ */
+static void printevents(int n, stats_t *stats)
+{
+    long long sum[PERFCTR_NEVENTS];
+    double ops[PERFCTR_NEVENTS];
+    int i, e, counted = 0;
+
+    printf("  %6s", "IPC");
+    for (e = 0; e < PERFCTR_NEVENTS; e++)
+        printf("%14s", perfctr_name(e));
+    printf("  %s\n", "trace");
+
+    memset(sum, 0, sizeof(sum));
+    memset(ops, 0, sizeof(ops));
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        if (stats[i].events[PERFCTR_INSTRUCTIONS] >= 0 &&
+            stats[i].events[PERFCTR_CYCLES] > 0)
+            printf("  %6.2f", (double)stats[i].events[PERFCTR_INSTRUCTIONS] /
+                   stats[i].events[PERFCTR_CYCLES]);
+        else
+            printf("  %6s", "n/a");
+        for (e = 0; e < PERFCTR_NEVENTS; e++) {
+            if (stats[i].events[e] < 0) {
+                printf("%14s", "n/a");
+                continue;
+            }
+            printf("%14.2f", stats[i].events[e] / stats[i].ops);
+            sum[e] += stats[i].events[e];
+            ops[e] += stats[i].ops;
+            counted = 1;
+        }
+        printf("  %s\n", stats[i].filename);
+    }
+
+    if (!counted) {
+        printf("  (hardware counters are not available here)\n");
+        return;
+    }
+    if (ops[PERFCTR_INSTRUCTIONS] > 0 && sum[PERFCTR_CYCLES] > 0)
+        printf("  %6.2f", (double)sum[PERFCTR_INSTRUCTIONS] /
+               sum[PERFCTR_CYCLES]);
+    else
+        printf("  %6s", "n/a");
+    for (e = 0; e < PERFCTR_NEVENTS; e++) {
+        if (ops[e] > 0)
+            printf("%14.2f", sum[e] / ops[e]);
+        else
+            printf("%14s", "n/a");
+    }
+    printf("  %s\n", "all traces");
+}
+
+/*
+ * printsim - prints the metadata accesses and the misses at each
+ *     simulated level measured by eval_mm_sim, per request. The last
+ *     line is over all the traces.
+ */
+static void printsim(int n, stats_t *stats)
+{
+    unsigned long long acc = 0, miss[SIM_NLEVELS];
+    double ops = 0;
+    int i, l;
+
+    printf("  %9s", "accesses");
+    for (l = 0; l < SIM_NLEVELS; l++)
+        printf("%9s", cachesim_name(l));
+    printf("  %s\n", "trace");
+
+    memset(miss, 0, sizeof(miss));
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %9.2f", stats[i].sim_accesses / stats[i].ops);
+        for (l = 0; l < SIM_NLEVELS; l++) {
+            printf("%9.3f", stats[i].sim_misses[l] / stats[i].ops);
+            miss[l] += stats[i].sim_misses[l];
+        }
+        printf("  %s\n", stats[i].filename);
+        acc += stats[i].sim_accesses;
+        ops += stats[i].ops;
+    }
+    if (ops == 0)
+        return;
+    printf("  %9.2f", acc / ops);
+    for (l = 0; l < SIM_NLEVELS; l++)
+        printf("%9.3f", miss[l] / ops);
+    printf("  %s\n", "all traces");
+}
+
+/*
+ * printlocality - prints where mm malloc placed the blocks in the util
+ *     run: the share of allocations within a page of the one before and
+ *     the median distance between them, the share of frees whose address
+ *     came back within LOC_WINDOW allocations (and in the next one), and
+ *     how full the lines and pages covered at the live-bytes peak were
+ */
+static void printlocality(int n, stats_t *stats)
+{
+    const locality_t *loc;
+    int i;
+
+    printf("  %6s%9s%7s%6s%10s%9s%7s%6s%6s  %s\n", "near%", "dist",
+           "reuse%", "next%", "peak KB", "lines", "pages", "line%", "page%",
+           "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        loc = &stats[i].loc;
+        printf("  %6.1f%9llu%7.1f%6.1f%10zu%9zu%7zu%6.1f%6.1f  %s\n",
+               loc->allocs ? 100.0 * loc->near / loc->allocs : 0,
+               loc->dist_p50,
+               loc->frees ? 100.0 * loc->reused / loc->frees : 0,
+               loc->frees ? 100.0 * loc->reused_next / loc->frees : 0,
+               loc->peak_bytes / 1024, loc->lines, loc->pages,
+               loc->lines ? 100.0 * loc->peak_bytes / (loc->lines * LOC_LINE) : 0,
+               loc->pages ? 100.0 * loc->peak_bytes / (loc->pages * LOC_PAGE) : 0,
+               stats[i].filename);
+    }
+}
+
+/*
+ * printwaste - prints the breakdown of the heap at the peak of the live
+ *     bytes made by eval_mm_waste, each part as a share of the heap:
+ *     payload, headers and footers, alignment padding, minimum-block
+ *     padding, unsplit remainders, free blocks, and the rest (prologue,
+ *     epilogue and free-list heads)
+ */
+static void printwaste(int n, stats_t *stats)
+{
+    const mm_waste_t *w;
+    double heap;
+    size_t used;
+    int i;
+
+    printf("  %9s%9s%8s%8s%8s%8s%8s%8s  %s\n", "heap KB", "payload",
+           "meta", "align", "minblk", "unsplit", "free", "other", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].waste_heap == 0)
+            continue;
+        w = &stats[i].waste;
+        heap = stats[i].waste_heap / 100.0;
+        used = w->payload + w->meta + w->align + w->minblock + w->remainder;
+        printf("  %9zu%8.1f%%%7.1f%%%7.1f%%%7.1f%%%7.1f%%%7.1f%%%7.1f%%  %s\n",
+               stats[i].waste_heap / 1024, w->payload / heap, w->meta / heap,
+               w->align / heap, w->minblock / heap, w->remainder / heap,
+               stats[i].waste_free / heap,
+               (stats[i].waste_heap - used - stats[i].waste_free) / heap,
+               stats[i].filename);
+    }
+}
+
 /*
  * usage - Explain the command line arguments
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    fprintf(stderr, "Usage: mdriver [-hlVadDbEFLMORSz] [-e <n>] [-T <pct>] [-i <n>] [-j <n>] [-C <cpu>] [-P <policy>] [-u <n>] [-K <k,eps,max>] [-p <n>] [-H <n>] [-g <pages>] [-m <n>] [-W <n>] [-f <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
+    fprintf(stderr, "\t-e <n>     Like -D, but check n random blocks per request.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
@@ -1386,5 +3246,27 @@ static void usage(void)
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
+    fprintf(stderr, "\t-p <n>     Profile free-list searches and report the n slowest requests.\n");
+    fprintf(stderr, "\t-H <n>     Sample the heap every n bytes; write <trace>.heap.\n");
+    fprintf(stderr, "\t-i <n>     Walk the heap every n requests; write <trace>.timeline.csv.\n");
+    fprintf(stderr, "\t-b         Grow only the simulated break; don't call sbrk.\n");
+    fprintf(stderr, "\t-F         Count page faults and pages touched on a fresh heap.\n");
+    fprintf(stderr, "\t-E         Count hardware events (instructions, cache misses...) per request.\n");
+    fprintf(stderr, "\t-M         Simulate the caches and TLBs over mm.c's metadata accesses (mdriver.sim).\n");
+    fprintf(stderr, "\t-a         Break down the heap at its peak: payload, headers, padding, free.\n");
+    fprintf(stderr, "\t-O         Score placement: distance between blocks, address reuse, lines and pages.\n");
+    fprintf(stderr, "\t-L         Time each request; report latency percentiles by type.\n");
+    fprintf(stderr, "\t-R         Also report utilization against resident heap pages.\n");
+    fprintf(stderr, "\t-g <pages> Back the heap with huge pages (thp or hugetlb) and compare with 4K.\n");
+    fprintf(stderr, "\t-m <n>     Reserve n bytes for each heap (default 1 GB).\n");
+    fprintf(stderr, "\t-W <n>     Prefault n bytes of the heap; report warm and cold throughput.\n");
+    fprintf(stderr, "\t-j <n>     Run the traces in n processes, each pinned to its own CPU.\n");
+    fprintf(stderr, "\t-T <pct>   Write each new payload; read a live block before pct%% of requests.\n");
+    fprintf(stderr, "\t-S         Stream the traces from disk instead of loading them.\n");
+    fprintf(stderr, "\t-z         Cold runs: clflush the heap and trace, not the whole cache.\n");
+    fprintf(stderr, "\t-C <cpu>   Run the driver on CPU <cpu> only.\n");
+    fprintf(stderr, "\t-P <policy> Schedule the driver as fifo, rr, batch or other.\n");
+    fprintf(stderr, "\t-u <n>     Replay each trace n times untimed before timing it.\n");
+    fprintf(stderr, "\t-K <k,eps,max> K-best timing: k runs within eps, at most max runs (3,0.01,20).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
 }
@@ -2,9 +2,16 @@
  * memlib.c - a module that simulates the memory system.	Needed because it
  *						allows us to interleave calls from the student's malloc package
  *						with the system's malloc package in libc.
+ *
+ * Each simulated heap is a context (mem_ctx_t) with its own region and
+ * brk, so one process can hold many isolated heaps. The unsuffixed
+ * functions (mem_sbrk, mem_heap_lo, ...) act on the context bound with
+ * mem_ctx_bind. In the driver build the binding is per thread, which lets
+ * several threads each run the allocator on a heap of their own.
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
@@ -17,38 +24,263 @@
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * A heap reserves address space for max_heap bytes up front, without
+ * backing memory, so that it never has to move and other mappings cannot
+ * land inside it; memory is only used as the brk reaches it.
+ *
+ * Outside the driver the model is the program's real heap: the
+ * reservation is inaccessible and made accessible MEM_COMMIT bytes at a
+ * time as the brk passes it. The driver maps it accessible from the start,
+ * so that extending the heap costs no system call.
+ */
+#ifndef DRIVER
+#define MEM_RESERVE (1UL << 36)
+#define MEM_TLS
+#else
+#define MEM_RESERVE MAX_HEAP
+#define MEM_TLS __thread
+#endif
+#define MEM_COMMIT (1UL << 20)
+
+/* smallest reservation mem_ctx_create falls back to */
+#define MEM_RESERVE_MIN (1UL << 24)
+
+/* hugetlb pages are taken from the pool when the heap is mapped, so
+   hugetlb heaps are limited to this size */
+#define MEM_HUGETLB_MAX (1UL << 30)
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/* Size of a huge page, to which huge-page heaps are aligned */
+#define MEM_HUGE_SIZE (1UL << 21)
+
+/*
+ * A context lives in the page just before the heap, in the heap's own
+ * mapping, so creating one never calls malloc.
+ */
+struct mem_ctx {
+	char *base;				/* start of the mapping */
+	char *heap;				/* first heap byte */
+	char *brk;				/* end of the heap */
+	char *max_addr;			/* end of the region */
+	char *committed;		/* end of the part in use so far */
+	size_t map_size;		/* bytes mapped, header page included */
+	int prot;				/* PROT_NONE until committed */
+	size_t peak_resident;	/* most resident pages seen since the last purge */
+	int pages;				/* MEM_PAGES_xxx the heap actually got */
+};
+
 /* private variables */
-static char *heap;
-static char *mem_brk;
-static char *mem_max_addr;
+static MEM_TLS mem_ctx_t *current = NULL;
+static int real_sbrk = 1;	/* mirror each extension with the real sbrk */
+static int page_mode = MEM_PAGES_SMALL;	/* for contexts created from now on */
+static size_t prefault_bytes = 0;		/* ditto */
+
+static int commit(mem_ctx_t *ctx, char *end);
+
+/*
+ * map_heap - Map size bytes for a heap with the given protection and
+ *		page mode, aligned to align. Returns the start of the aligned
+ *		area, and the mapping itself through base and map_size.
+ */
+static char *map_heap(size_t size, size_t align, int prot, int mode,
+		char **base, size_t *map_size){
+	char *p;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+#ifdef MAP_HUGETLB
+	/* hugetlb mappings come aligned but need a size in whole huge pages.
+	   They must reserve their pages, or an empty pool would only show up
+	   as SIGBUS on first touch. */
+	if (mode == MEM_PAGES_HUGETLB) {
+		size = (size + MEM_HUGE_SIZE - 1) & ~(MEM_HUGE_SIZE - 1);
+		p = mmap(NULL, size, prot, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+		*base = p;
+		*map_size = size;
+		return p;
+	}
+#endif
+	(void)mode;
+
+	*map_size = size + align - mem_pagesize();
+	p = mmap(NULL, *map_size, prot, flags, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	*base = p;
+	return (char *)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+/*
+ * prefault - Fault in the pages of [p, p+size) for writing, so that the
+ *		heap's first use does not pay for them
+ */
+static void prefault(char *p, size_t size){
+	size_t page = mem_pagesize();
+	size_t i;
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(p, size, MADV_POPULATE_WRITE) == 0)
+		return;
+#endif
+	for (i = 0; i < size; i += page)
+		((volatile char *)p)[i] = 0;
+}
+
+/*
+ * mem_ctx_create - make a new, empty heap of at most max_heap bytes
+ *		(0 picks the default). If that much address space cannot be had,
+ *		the heap is halved until it can, down to MEM_RESERVE_MIN. Returns
+ *		NULL if there is no memory for it.
+ *		The heap uses the page size chosen with mem_set_page_mode, falling
+ *		back to huge pages on demand, then to small pages, if the system
+ *		cannot provide it.
+ */
+mem_ctx_t *mem_ctx_create(size_t max_heap){
+	size_t page = mem_pagesize();
+	size_t align = page, map_size;
+	mem_ctx_t *ctx;
+	char *base, *heap = NULL;
+	int prot = PROT_READ | PROT_WRITE;
+	int mode = page_mode;
+
+	if (max_heap == 0)
+		max_heap = MEM_RESERVE;
+	max_heap = (max_heap + page - 1) & ~(page - 1);
+
+#ifndef DRIVER
+	prot = PROT_NONE;
+#endif
+	if (mode != MEM_PAGES_SMALL)
+		align = MEM_HUGE_SIZE;
+	/* hugetlb pages cannot be committed piecemeal */
+	if (mode == MEM_PAGES_HUGETLB && prot == PROT_NONE)
+		mode = MEM_PAGES_HUGE;
+
+	/* the header page goes just below the aligned heap */
+	if (mode == MEM_PAGES_HUGETLB) {
+		heap = map_heap(MEM_HUGE_SIZE + MIN(max_heap, MEM_HUGETLB_MAX), align,
+				prot, mode, &base, &map_size);
+		if (heap != NULL)
+			heap += MEM_HUGE_SIZE;
+		else
+			mode = MEM_PAGES_HUGE;
+	}
+	if (heap == NULL) {
+		/* a limit on the address space (ulimit -v) or strict overcommit
+		   may refuse the full reservation; settle for a smaller heap */
+		while ((heap = map_heap(page + max_heap, align, prot, mode, &base,
+						&map_size)) == NULL) {
+			if (errno != ENOMEM || max_heap / 2 < MEM_RESERVE_MIN)
+				return NULL;
+			max_heap = (max_heap / 2 + page - 1) & ~(page - 1);
+		}
+		heap = (heap - base >= (ptrdiff_t)page) ? heap : heap + align;
+	}
+	if (prot == PROT_NONE && mprotect(heap - page, page, PROT_READ | PROT_WRITE) < 0) {
+		munmap(base, map_size);
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if (mode == MEM_PAGES_HUGE && madvise(heap, base + map_size - heap, MADV_HUGEPAGE) < 0)
+		mode = MEM_PAGES_SMALL;
+#else
+	if (mode == MEM_PAGES_HUGE)
+		mode = MEM_PAGES_SMALL;
+#endif
+
+	ctx = (mem_ctx_t *)(heap - page);
+	ctx->base = base;
+	ctx->heap = heap;
+	ctx->brk = ctx->heap;
+	ctx->max_addr = base + map_size;
+	ctx->committed = ctx->heap;
+	ctx->map_size = map_size;
+	ctx->prot = prot;
+	ctx->peak_resident = 0;
+	ctx->pages = mode;
+
+	if (prefault_bytes > 0) {
+		size_t n = MIN(prefault_bytes, (size_t)(ctx->max_addr - ctx->heap));
+		if (commit(ctx, ctx->heap + n) == 0)
+			prefault(ctx->heap, n);
+	}
+	return ctx;
+}
+
+/*
+ * commit - Make the heap usable up to end, which must lie within the
+ *		reservation. Returns 0 on success, -1 if there is no memory.
+ */
+static int commit(mem_ctx_t *ctx, char *end){
+	size_t size;
+
+	if (end <= ctx->committed)
+		return 0;
+	size = (end - ctx->committed + MEM_COMMIT - 1) & ~(MEM_COMMIT - 1);
+	size = MIN(size, (size_t)(ctx->max_addr - ctx->committed));
+	if (ctx->prot == PROT_NONE &&
+			mprotect(ctx->committed, size, PROT_READ | PROT_WRITE) < 0)
+		return -1;
+	ctx->committed += size;
+	return 0;
+}
+
+/*
+ * mem_ctx_destroy - release a heap; it is unbound first if it is current
+ */
+void mem_ctx_destroy(mem_ctx_t *ctx){
+	if (ctx == NULL)
+		return;
+	if (ctx == current)
+		current = NULL;
+	munmap(ctx->base, ctx->map_size);
+}
+
+/*
+ * mem_ctx_bind - make ctx the heap the unsuffixed functions act on, and
+ *		return the one that was bound before
+ */
+mem_ctx_t *mem_ctx_bind(mem_ctx_t *ctx){
+	mem_ctx_t *prev = current;
+	current = ctx;
+	return prev;
+}
+
+/*
+ * mem_ctx_current - return the bound heap, or NULL
+ */
+mem_ctx_t *mem_ctx_current(void){
+	return current;
+}
 
 /*
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model, binding a fresh heap
+ *		unless one is bound already
  */
 void mem_init(void){
-	int dev_zero = open("/dev/zero", O_RDWR);
-	heap = mmap((void *)0x800000000, /* suggested start*/
-			MAX_HEAP,				/* length */
-			PROT_WRITE,				/* permissions */
-			MAP_PRIVATE,			/* private or shared? */
-			dev_zero,				/* fd */
-			0);						/* offset (dunno) */
-	mem_max_addr = heap + MAX_HEAP;
-	mem_brk = heap;					/* heap is empty initially */
+	if (current == NULL)
+		current = mem_ctx_create(0);
 }
 
 /*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-	munmap(heap, MAX_HEAP);
+	mem_ctx_destroy(current);
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
+void mem_reset_brk_ctx(mem_ctx_t *ctx){
+	ctx->brk = ctx->heap;
+}
+
 void mem_reset_brk(){
-	mem_brk = heap;
+	mem_reset_brk_ctx(current);
 }
 
 /*
@@ -56,40 +288,160 @@ void mem_reset_brk(){
  *		by incr bytes and returns the start address of the new area. In
  *		this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) {
-	char *old_brk = mem_brk;
+void *mem_sbrk_ctx(mem_ctx_t *ctx, intptr_t incr) {
+	char *old_brk;
+
+	if (ctx == NULL || incr < 0 ||
+			(size_t)incr > (size_t)(ctx->max_addr - ctx->brk) ||
+			commit(ctx, ctx->brk + incr) < 0) {
+		errno = ENOMEM;
+#ifdef DRIVER
+		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+#endif
+		return (void *)-1;
+	}
+	old_brk = ctx->brk;
 
+#ifdef DRIVER
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+	if (real_sbrk && sbrk(incr) == (void *) -1) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
+#endif
 
-	mem_brk += incr;
+	ctx->brk += incr;
 	return (void *)old_brk;
 }
 
+void *mem_sbrk(intptr_t incr) {
+	return mem_sbrk_ctx(current, incr);
+}
+
+/*
+ * mem_set_real_sbrk - Choose whether mem_sbrk also calls the real sbrk
+ *		(the default in the driver). Turning it off grows only the simulated
+ *		break, so the cost of heap extension is the allocator's own.
+ */
+void mem_set_real_sbrk(int on) {
+	real_sbrk = on;
+}
+
+/*
+ * mem_set_page_mode - Choose the pages that back heaps created from now
+ *		on: MEM_PAGES_SMALL (the default), MEM_PAGES_HUGE for transparent
+ *		huge pages, or MEM_PAGES_HUGETLB for the hugetlb pool
+ */
+void mem_set_page_mode(int mode) {
+	page_mode = mode;
+}
+
+/*
+ * mem_set_prefault - Fault in the first bytes of every heap created from
+ *		now on (0, the default, leaves the pages to be faulted on demand)
+ */
+void mem_set_prefault(size_t bytes) {
+	prefault_bytes = bytes;
+}
+
+/*
+ * mem_page_mode - return the MEM_PAGES_xxx a heap actually got
+ */
+int mem_page_mode_ctx(mem_ctx_t *ctx) {
+	return ctx->pages;
+}
+
+int mem_page_mode(void) {
+	return mem_page_mode_ctx(current);
+}
+
+/*
+ * mem_resident_pages - return the number of heap region pages that are
+ *		resident in memory, i.e. have been touched and not released. Each
+ *		call is also a sample for mem_peak_resident_pages.
+ */
+size_t mem_resident_pages_ctx(mem_ctx_t *ctx) {
+	unsigned char vec[4096];
+	size_t page = mem_pagesize();
+	size_t npages = (ctx->committed - ctx->heap) / page;
+	size_t i, n, count = 0;
+	char *p = ctx->heap;
+
+	while (npages > 0) {
+		n = (npages < sizeof(vec)) ? npages : sizeof(vec);
+		if (mincore(p, n * page, vec) < 0)
+			return 0;
+		for (i = 0; i < n; i++)
+			count += vec[i] & 1;
+		p += n * page;
+		npages -= n;
+	}
+	if (count > ctx->peak_resident)
+		ctx->peak_resident = count;
+	return count;
+}
+
+size_t mem_resident_pages(void) {
+	return mem_resident_pages_ctx(current);
+}
+
+/*
+ * mem_peak_resident_pages - return the largest count mem_resident_pages
+ *		has returned since the heap was created or last purged
+ */
+size_t mem_peak_resident_pages_ctx(mem_ctx_t *ctx) {
+	return ctx->peak_resident;
+}
+
+size_t mem_peak_resident_pages(void) {
+	return mem_peak_resident_pages_ctx(current);
+}
+
+/*
+ * mem_purge - release every page of the heap region back to the system,
+ *		as if it had never been touched. The contents read back as zeros.
+ */
+void mem_purge_ctx(mem_ctx_t *ctx) {
+	madvise(ctx->heap, ctx->committed - ctx->heap, MADV_DONTNEED);
+	ctx->peak_resident = 0;
+}
+
+void mem_purge(void) {
+	mem_purge_ctx(current);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
+void *mem_heap_lo_ctx(mem_ctx_t *ctx){
+	return (void *)ctx->heap;
+}
+
 void *mem_heap_lo(){
-	return (void *)heap;
+	return mem_heap_lo_ctx(current);
 }
 
 /*
  * mem_heap_hi - return address of last heap byte
  */
+void *mem_heap_hi_ctx(mem_ctx_t *ctx){
+	return (void *)(ctx->brk - 1);
+}
+
 void *mem_heap_hi(){
-	return (void *)(mem_brk - 1);
+	return mem_heap_hi_ctx(current);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
+size_t mem_heapsize_ctx(mem_ctx_t *ctx) {
+	return (size_t)((uintptr_t)ctx->brk - (uintptr_t)ctx->heap);
+}
+
 size_t mem_heapsize() {
-	return (size_t)((uintptr_t)mem_brk - (uintptr_t)heap);
+	return mem_heapsize_ctx(current);
 }
 
 /*
@@ -1,11 +1,44 @@
+#include <stdint.h>
 #include <unistd.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void mem_set_real_sbrk(int on);
 
+/* Pages backing the heap (mem_set_page_mode) */
+#define MEM_PAGES_SMALL   0   /* base pages */
+#define MEM_PAGES_HUGE    1   /* transparent huge pages (MADV_HUGEPAGE) */
+#define MEM_PAGES_HUGETLB 2   /* the hugetlb pool (MAP_HUGETLB) */
+void mem_set_page_mode(int mode);
+int mem_page_mode(void);
+void mem_set_prefault(size_t bytes);
+size_t mem_resident_pages(void);
+size_t mem_peak_resident_pages(void);
+void mem_purge(void);
+
+/*
+ * Heap contexts: independent simulated heaps. The functions above act on
+ * the context bound with mem_ctx_bind (per thread in the driver build);
+ * the _ctx variants act on the one given.
+ */
+typedef struct mem_ctx mem_ctx_t;
+
+mem_ctx_t *mem_ctx_create(size_t max_heap);
+void mem_ctx_destroy(mem_ctx_t *ctx);
+mem_ctx_t *mem_ctx_bind(mem_ctx_t *ctx);
+mem_ctx_t *mem_ctx_current(void);
+void *mem_sbrk_ctx(mem_ctx_t *ctx, intptr_t incr);
+void mem_reset_brk_ctx(mem_ctx_t *ctx);
+void *mem_heap_lo_ctx(mem_ctx_t *ctx);
+void *mem_heap_hi_ctx(mem_ctx_t *ctx);
+size_t mem_heapsize_ctx(mem_ctx_t *ctx);
+size_t mem_resident_pages_ctx(mem_ctx_t *ctx);
+size_t mem_peak_resident_pages_ctx(mem_ctx_t *ctx);
+void mem_purge_ctx(mem_ctx_t *ctx);
+int mem_page_mode_ctx(mem_ctx_t *ctx);
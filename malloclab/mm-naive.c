@@ -77,7 +77,7 @@ int mm_init(void)
 void *malloc(size_t size)
 {
   checkheap(1); // Let's make sure the heap is ok at the start
-  int newsize = ALIGN(size + SIZE_T_SIZE);
+  size_t newsize = ALIGN(size + SIZE_T_SIZE);
   unsigned char *p = mem_sbrk(newsize);
   //dbg_printf("malloc %u => %p\n", size, p);
 
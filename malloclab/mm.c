@@ -24,16 +24,26 @@
  */
 
 
+#ifndef DRIVER
+#define _GNU_SOURCE   /* for recursive mutexes */
+#endif
+
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#ifndef DRIVER
+#include <pthread.h>
+#endif
 #include "contracts.h"
 
 #include "mm.h"
 #include "memlib.h"
+#include "heapprof.h"
+#include "tracelog.h"
 
 
 // Create aliases for driver tests
@@ -64,12 +74,143 @@
 #define checkheap(...)
 #endif
 
+/*
+ *  Profiling
+ *  ---------
+ *  - In the driver build, PROF_ENTER/PROF_LEAVE bracket the internal
+ *    phases of a request and PROF_VISIT counts free-list nodes, all of
+ *    which cost a single branch unless mm_prof.enabled is set.  Phases
+ *    nest (extend_heap and alloc both coalesce), so cycles are charged
+ *    to the innermost active phase only.
+ */
+
+#ifdef DRIVER
+#include "clock.h"
+
+MM_TLS mm_prof_t mm_prof;
+static MM_TLS int prof_stack[MM_NPHASES];
+static MM_TLS int prof_depth = 0;
+static MM_TLS unsigned long long prof_stamp;
+
+static void prof_enter(int phase)
+{
+	unsigned long long now = read_counter();
+	if (prof_depth > 0)
+		mm_prof.cycles[prof_stack[prof_depth - 1]] += now - prof_stamp;
+	prof_stack[prof_depth++] = phase;
+	prof_stamp = now;
+}
+
+static void prof_leave(void)
+{
+	unsigned long long now = read_counter();
+	mm_prof.cycles[prof_stack[--prof_depth]] += now - prof_stamp;
+	prof_stamp = now;
+}
+
+#define PROF_ENTER(phase) do {if (mm_prof.enabled) prof_enter(phase);} while(0)
+#define PROF_LEAVE() do {if (mm_prof.enabled) prof_leave();} while(0)
+#define PROF_VISIT() do {if (mm_prof.enabled) mm_prof.visited++;} while(0)
+#else
+#define PROF_ENTER(phase)
+#define PROF_LEAVE()
+#define PROF_VISIT()
+#endif
+
+/*
+ *  Simulation
+ *  ----------
+ *  - Built with -DMM_SIM (mdriver.sim), the metadata accessors below
+ *    report each load and store to the driver's cache simulator while
+ *    mm_sim.enabled is set. SIM_TOUCH(p, n) reports n bytes at p and
+ *    yields p, so that it can sit inside an lvalue; in every other
+ *    build it is just p.
+ */
+
+#ifdef DRIVER
+MM_TLS mm_sim_t mm_sim;
+#ifdef MM_SIM
+const int mm_sim_built = 1;
+
+static inline void *sim_touch(void *p, size_t n)
+{
+	if (mm_sim.enabled)
+		mm_sim.access(p, n);
+	return p;
+}
+
+#define SIM_TOUCH(p, n) sim_touch((void *)(p), (n))
+#else
+const int mm_sim_built = 0;
+#endif
+#endif
+
+#ifndef SIM_TOUCH
+#define SIM_TOUCH(p, n) (p)
+#endif
+
+/*
+ *  Tracing
+ *  -------
+ *  - Outside the driver, each request can be logged to a trace file
+ *    (see tracelog.c). The public entry points log exactly once per
+ *    request; the internal malloc_block, free_block and realloc_block
+ *    do not log.
+ */
+
+#ifndef DRIVER
+#define TRACE_MALLOC(ptr, size) do {if (tracelog_enabled) \
+                             tracelog_malloc(ptr, size);} while(0)
+#define TRACE_FREE(ptr) do {if (tracelog_enabled) \
+                             tracelog_free(ptr);} while(0)
+#define TRACE_REALLOC(oldptr, ptr, size) do {if (tracelog_enabled) \
+                             tracelog_realloc(oldptr, ptr, size);} while(0)
+#else
+#define TRACE_MALLOC(ptr, size)
+#define TRACE_FREE(ptr)
+#define TRACE_REALLOC(oldptr, ptr, size)
+#endif
+
+/*
+ *  Locking
+ *  -------
+ *  - Outside the driver the allocator is shared by every thread of the
+ *    program, so the public entry points serialise on one lock. It is
+ *    recursive because mm_init may start helpers (the heap profiler,
+ *    the trace flusher) that allocate before it returns.
+ */
+
+#ifndef DRIVER
+static pthread_mutex_t mm_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+#define LOCK() pthread_mutex_lock(&mm_lock)
+#define UNLOCK() pthread_mutex_unlock(&mm_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/*
+ * Headers and footers are 4-byte words, which limits a block to just
+ * under 4 GiB. Build with -DWIDE_HEADERS for 8-byte words and blocks of
+ * any size; narrow builds refuse requests that would not fit.
+ */
+#ifdef WIDE_HEADERS
+typedef unsigned long word_t;
+#define WSIZE       8       /* Word and header/footer size (bytes) */
+#define DSIZE       16      /* Doubleword size (bytes) */
+#define HEADER_SIZE    32  /* minimum block size */
+#else
+typedef unsigned int word_t;
 #define WSIZE       4       /* Word and header/footer size (bytes) */
 #define DSIZE       8       /* Doubleword size (bytes) */
-#define CHUNKSIZE  1<<9  /* Extend heap by this amount (bytes) */
 #define HEADER_SIZE    24  /* minimum block size */
+#endif
+#define CHUNKSIZE  1<<9  /* Extend heap by this amount (bytes) */
 #define LIST_NO 20
 
+/* Largest block a header can describe */
+#define MAX_BLOCK ((size_t)(word_t)~0UL & ~(size_t)0x7)
+
 
 
 /* 4 or 8 byte alignment */
@@ -84,12 +225,23 @@
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p)       (*(unsigned int *)(p))
-#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+#define GET(p)       (*(word_t *)SIM_TOUCH(p, WSIZE))
+#define PUT(p, val)  (*(word_t *)SIM_TOUCH(p, WSIZE) = (val))
 
 #define GETP(p)       ((void *)(p))
 #define PUTP(p, val)  (*(void *)(p) = (val))
 
+/* Header bit marking a block sampled by the heap profiler */
+#define SAMPLED 0x2
+
+/* Offer a newly allocated block to the heap profiler, which wants to see
+ * about one block per sampling interval; flag the block if it was taken */
+#define HEAPPROF_ALLOC(bp, size) do {if ((heapprof_countdown -= (long)(size)) < 0 \
+                                     && heapprof_sample(bp, size)) { \
+                             PUT(HDRP(bp), GET(HDRP(bp)) | SAMPLED); \
+                             PUT(FTRP(bp), GET(FTRP(bp)) | SAMPLED); \
+                        }}while(0)
+
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
@@ -101,8 +253,8 @@
 /* The pointer to the next free block is stored in the current pointer bp
  * The pointer to the previous free block is stored one address space away.
  */
-#define NEXT_FREE_BLK(bp) (*(char **)(bp))
-#define PREV_FREE_BLK(bp) (*((char **)(bp) + 1))
+#define NEXT_FREE_BLK(bp) (*(char **)SIM_TOUCH(bp, sizeof(char *)))
+#define PREV_FREE_BLK(bp) (*(char **)SIM_TOUCH((char **)(bp) + 1, sizeof(char *)))
 
 
 /* Given block ptr bp, compute address of next and previous blocks */
@@ -116,17 +268,24 @@ static void *first_fit(size_t req_size);
 static void *coalesce(void *bp);
 static void printblock(void *bp);
 static void checkblock(void *bp);
-static void insert_free_list(void *bp, int size);
-static void remove_block(void *bp,int size);
-static int get_free_list_head( unsigned int n);
+static void insert_free_list(void *bp, size_t size);
+static void remove_block(void *bp, size_t size);
+static int get_free_list_head(size_t n);
+static void *malloc_block(size_t size);
+static void free_block(void *ptr);
+static void *realloc_block(void *oldptr, size_t size);
+#ifndef DRIVER
+static void *memalign_block(size_t alignment, size_t size);
+#endif
+static void trim_block(void *bp, size_t asize);
 
 
 
-static char *heap_list_head = 0;
-static char *heap_header = 0;
-static char *free_list_head;
+static MM_TLS char *heap_list_head = 0;
+static MM_TLS char *heap_header = 0;
+static MM_TLS char *free_list_head;
 
-#define GET_FREE_HEAD(i) (*((char **)(free_list_head) + i))
+#define GET_FREE_HEAD(i) (*(char **)SIM_TOUCH((char **)(free_list_head) + i, sizeof(char *)))
 //static int malloc_count = 0; /*DEbugging variables*/
 //static int free_count = 0;
 
@@ -139,14 +298,64 @@ void init_free_list(char *bp)
 		GET_FREE_HEAD(i) = bp;
 }
 
+#ifndef DRIVER
+/*
+ * fork handlers - Keep the heap consistent across fork() by holding the
+ *     lock while the child is created. The child's copy of the lock is
+ *     owned by a thread that no longer exists there, so it gets a fresh
+ *     one, and it drops the parent's trace, whose flusher thread is not
+ *     copied and whose file the parent still has to finish.
+ */
+static void fork_prepare(void)
+{
+	LOCK();
+}
+
+static void fork_parent(void)
+{
+	UNLOCK();
+}
+
+static void fork_child(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&mm_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	tracelog_fork_child();
+}
+
+/*
+ * heapprof_at_exit - Write the heap profile started from the environment.
+ *     Other threads may still be in malloc or free, updating the
+ *     profile's tables under mm_lock, so the dump holds it too.
+ */
+static void heapprof_at_exit(void)
+{
+	LOCK();
+	heapprof_dump_to_env();
+	UNLOCK();
+}
+#endif
+
 /*
  * Initialize: return -1 on error, 0 on success.
  */
 int mm_init(void)
 {
 
-	if ((heap_list_head = mem_sbrk(2 * HEADER_SIZE + 20*DSIZE)) == NULL )
+#ifndef DRIVER
+	/* there is no driver to set up the memory system for us */
+	mem_init();
+#endif
+
+	if ((heap_list_head = mem_sbrk(2 * HEADER_SIZE + 20*DSIZE)) == (void *)-1 )
+	{
+		heap_list_head = 0;
 		return -1;
+	}
 
 	PUT(heap_list_head, 0); //Alignment padding
 
@@ -173,6 +382,14 @@ int mm_init(void)
 	/*return -1 if unable to get heap space*/
 	if ((heap_list_head = extend_heap(CHUNKSIZE / WSIZE)) == NULL )
 		return -1;
+
+#ifndef DRIVER
+	/* the heap is usable now, so these may allocate from it */
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+	if (heapprof_start_from_env())
+		atexit(heapprof_at_exit);
+	tracelog_start_from_env();
+#endif
 	return 0;
 
 }
@@ -208,6 +425,7 @@ static void *extend_heap(size_t words)
 
 static void *coalesce(void *bp)
 {
+	PROF_ENTER(MM_PHASE_COALESCE);
 	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp))) || (PREV_BLKP(bp) == bp);
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 	size_t size = GET_SIZE(HDRP(bp));
@@ -248,6 +466,7 @@ static void *coalesce(void *bp)
 	}
 
 	insert_free_list(bp,size);
+	PROF_LEAVE();
 	return bp;
 }
 
@@ -255,7 +474,7 @@ static void *coalesce(void *bp)
  * free list.
  *
  */
-static void insert_free_list(void *bp, int size)
+static void insert_free_list(void *bp, size_t size)
 {
 	int free_list_index = get_free_list_head(size);
 	NEXT_FREE_BLK(bp) = GET_FREE_HEAD(free_list_index);
@@ -268,7 +487,7 @@ static void insert_free_list(void *bp, int size)
  * Sets the next pointer of the previous-free block of bp to the next-free block of bp
  * Sets the previous pointer of the next-free block of bp to the previous-free block of bp
  */
-static void remove_block(void *bp, int size)
+static void remove_block(void *bp, size_t size)
 {
 	if (PREV_FREE_BLK(bp) != NULL )
 		NEXT_FREE_BLK(PREV_FREE_BLK(bp)) = NEXT_FREE_BLK(bp);
@@ -283,6 +502,35 @@ static void remove_block(void *bp, int size)
  * malloc
  */
 void *malloc (size_t size)
+{
+	char *bp;
+
+#ifndef DRIVER
+	/* programs expect a unique pointer, not NULL, for malloc(0) */
+	if (size == 0)
+		size = 1;
+#endif
+
+	LOCK();
+	if (heap_list_head == 0 && mm_init() < 0)
+	{
+		UNLOCK();
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	bp = malloc_block(size);
+	if (bp)
+		HEAPPROF_ALLOC(bp, size);
+	TRACE_MALLOC(bp, size);
+	UNLOCK();
+	return bp;
+}
+
+/*
+ * malloc_block - Find or make room for a block of size bytes
+ */
+static void *malloc_block(size_t size)
 {
 	//printf("\nMalloc Count: %d\n",++malloc_count);
 	size_t asize;
@@ -293,11 +541,21 @@ void *malloc (size_t size)
 	if (size <= 0)
 		return NULL;
 
+	/* Refuse blocks too big for a header */
+	if (size > MAX_BLOCK - DSIZE - ALIGNMENT)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
 	/* Adjust block size to include overhead and alignment reqs */
 	asize = MAX(ALIGN(size) + DSIZE, HEADER_SIZE);
 
 	/* Search the free list for a fit */
-	if ((bp = first_fit(asize)))
+	PROF_ENTER(MM_PHASE_SEARCH);
+	bp = first_fit(asize);
+	PROF_LEAVE();
+	if (bp)
 	{
 		alloc(bp, asize);
 		//mm_checkheap(1);
@@ -305,7 +563,10 @@ void *malloc (size_t size)
 	}
 
 	extendsize = MAX(asize, CHUNKSIZE);
-	if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+	PROF_ENTER(MM_PHASE_EXTEND);
+	bp = extend_heap(extendsize/WSIZE);
+	PROF_LEAVE();
+	if (bp == NULL)
 		return NULL; 	//return NULL if unable to get heap space
 	alloc(bp, asize);
 	//mm_checkheap(1);
@@ -317,6 +578,17 @@ void *malloc (size_t size)
  * free- Free the occupied block and coalesces the block
  */
 void free(void *ptr)
+{
+	LOCK();
+	TRACE_FREE(ptr);
+	free_block(ptr);
+	UNLOCK();
+}
+
+/*
+ * free_block - Return the block to the free list
+ */
+static void free_block(void *ptr)
 {
 
 	//printf("\nFree Count: %d\n",++free_count);
@@ -324,9 +596,11 @@ void free(void *ptr)
 	if (ptr == 0)
 		return;
 	size_t size = GET_SIZE(HDRP(ptr));
-	if (heap_list_head == 0)
-		mm_init();
+	if (heap_list_head == 0 && mm_init() < 0)
+		return;
 
+	if (GET(HDRP(ptr)) & SAMPLED)
+		heapprof_free(ptr);
 	PUT(HDRP(ptr), PACK(size, 0));
 	PUT(FTRP(ptr), PACK(size, 0));
 	coalesce(ptr);
@@ -337,22 +611,55 @@ void free(void *ptr)
  * realloc - referred mm-naive.c
  */
 void *realloc(void *oldptr, size_t size)
+{
+	void *newptr;
+
+	LOCK();
+	if (heap_list_head == 0 && mm_init() < 0)
+	{
+		UNLOCK();
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	newptr = realloc_block(oldptr, size);
+	TRACE_REALLOC(oldptr, newptr, size);
+	UNLOCK();
+	return newptr;
+}
+
+/*
+ * realloc_block - Resize the block in place if possible, else move it
+ */
+static void *realloc_block(void *oldptr, size_t size)
 {
 	size_t oldsize;
 	void *newptr;
-	/* Adjust block size to include overhead and alignment reqs */
-	size_t req_size = MAX(ALIGN(size) + DSIZE, HEADER_SIZE);
+	size_t req_size;
 	/* If size == 0 then this is just free, and we return NULL. */
 	if (size == 0)
 	{
-		free(oldptr);
+		free_block(oldptr);
 		return 0;
 	}
 
 	/* If oldptr is NULL, then this is just malloc. */
 	if (oldptr == NULL )
-		return malloc(size);
+	{
+		if ((newptr = malloc_block(size)))
+			HEAPPROF_ALLOC(newptr, size);
+		return newptr;
+	}
 
+	/* Refuse blocks too big for a header */
+	if (size > MAX_BLOCK - DSIZE - ALIGNMENT)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* Adjust block size to include overhead and alignment reqs */
+	req_size = MAX(ALIGN(size) + DSIZE, HEADER_SIZE);
 	oldsize = GET_SIZE(HDRP(oldptr));
 
 	if(req_size == oldsize || (oldsize-req_size)<=HEADER_SIZE)
@@ -360,18 +667,19 @@ void *realloc(void *oldptr, size_t size)
 
 	if(req_size <= oldsize)
 	{
-		PUT(HDRP(oldptr),PACK(req_size,1));
-		PUT(FTRP(oldptr),PACK(req_size,1));
-		PUT(HDRP(NEXT_BLKP(oldptr)),PACK(oldsize-req_size,1));
-		PUT(FTRP(NEXT_BLKP(oldptr)),PACK(oldsize-req_size,1));
-		free(NEXT_BLKP(oldptr));
+		/* to the profiler, shrinking in place is a free and a malloc */
+		if (GET(HDRP(oldptr)) & SAMPLED)
+			heapprof_free(oldptr);
+		trim_block(oldptr, req_size);
+		HEAPPROF_ALLOC(oldptr, size);
 		return oldptr;
 	}
 
-	newptr = malloc(size);
+	newptr = malloc_block(size);
 	/* If realloc() fails the original block is left untouched  */
 	if (!newptr)
 		return 0;
+	HEAPPROF_ALLOC(newptr, size);
 
 	/* Copy the old data. */
 
@@ -380,7 +688,7 @@ void *realloc(void *oldptr, size_t size)
 	memcpy(newptr, oldptr, oldsize);
 
 	/* Free the old block. */
-	free(oldptr);
+	free_block(oldptr);
 
 	return newptr;
 }
@@ -393,12 +701,155 @@ void *calloc (size_t nmemb, size_t size)
 	size_t bytes = nmemb * size;
 	void *newptr;
 
+	/* refuse requests whose size overflows */
+	if (size != 0 && bytes / size != nmemb)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
 	newptr = malloc(bytes);
-	memset(newptr, 0, bytes);
+	if (newptr)
+		memset(newptr, 0, bytes);
 
 	return newptr;
 }
 
+/*
+ * trim_block - Shrink the allocated block at bp to asize bytes, giving
+ *              the rest back to the free list if it can hold a block
+ */
+static void trim_block(void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	if (csize - asize < HEADER_SIZE)
+		return;
+	PUT(HDRP(bp),PACK(asize,1));
+	PUT(FTRP(bp),PACK(asize,1));
+	PUT(HDRP(NEXT_BLKP(bp)),PACK(csize-asize,1));
+	PUT(FTRP(NEXT_BLKP(bp)),PACK(csize-asize,1));
+	free_block(NEXT_BLKP(bp));
+}
+
+#ifndef DRIVER
+/*
+ * memalign_block - Allocate a block whose payload is aligned to
+ *          alignment bytes (a power of two). Over-allocates, then frees
+ *          the space in front of the aligned payload and trims the tail.
+ */
+static void *memalign_block(size_t alignment, size_t size)
+{
+	char *bp, *abp;
+	size_t csize, lead;
+
+	if (alignment <= ALIGNMENT)
+		return malloc_block(size);
+
+	/* leave room for an aligned payload with a whole free block before it */
+	if (size > SIZE_MAX - alignment - HEADER_SIZE)
+		return NULL;
+	if ((bp = malloc_block(size + alignment + HEADER_SIZE)) == NULL)
+		return NULL;
+
+	abp = (char *)(((uintptr_t)bp + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	if (abp != bp && (size_t)(abp - bp) < HEADER_SIZE)
+		abp += alignment;
+
+	if (abp != bp)
+	{
+		csize = GET_SIZE(HDRP(bp));
+		lead = abp - bp;
+		PUT(HDRP(abp), PACK(csize - lead, 1));
+		PUT(FTRP(abp), PACK(csize - lead, 1));
+		PUT(HDRP(bp), PACK(lead, 1));
+		PUT(FTRP(bp), PACK(lead, 1));
+		free_block(bp);
+	}
+
+	trim_block(abp, MAX(ALIGN(size) + DSIZE, HEADER_SIZE));
+	return abp;
+}
+
+/*
+ * memalign - Allocate size bytes aligned to alignment (a power of two)
+ */
+void *memalign(size_t alignment, size_t size)
+{
+	void *bp;
+
+	if (alignment & (alignment - 1))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	if (size == 0)
+		size = 1;
+
+	LOCK();
+	if (heap_list_head == 0 && mm_init() < 0)
+	{
+		UNLOCK();
+		errno = ENOMEM;
+		return NULL;
+	}
+	if ((bp = memalign_block(alignment, size)))
+		HEAPPROF_ALLOC(bp, size);
+	TRACE_MALLOC(bp, size);
+	UNLOCK();
+	return bp;
+}
+
+/*
+ * posix_memalign - memalign with the POSIX calling convention
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *bp;
+
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+		return EINVAL;
+	if ((bp = memalign(alignment, size)) == NULL)
+		return ENOMEM;
+	*memptr = bp;
+	return 0;
+}
+
+/*
+ * aligned_alloc - C11 spelling of memalign
+ */
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+/*
+ * valloc, pvalloc - page-aligned allocations; pvalloc also rounds the
+ *                   size up to whole pages
+ */
+void *valloc(size_t size)
+{
+	return memalign(mem_pagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = mem_pagesize();
+	return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+/*
+ * malloc_usable_size - Bytes available in the payload of ptr, which can
+ *                      exceed the size asked for
+ */
+size_t malloc_usable_size(void *ptr)
+{
+	if (ptr == NULL)
+		return 0;
+	return GET_SIZE(HDRP(ptr)) - DSIZE;
+}
+#endif
+
 /*
  * alloc - Allocates  block of req_size bytes at start of free block
  *         and split if free block is larger
@@ -406,6 +857,7 @@ void *calloc (size_t nmemb, size_t size)
 static void alloc(void *free_block, size_t req_size)
 {
 	void *next_bp;
+	PROF_ENTER(MM_PHASE_SPLIT);
     size_t csize = GET_SIZE(HDRP(free_block));
     //Split the free block into allocated and free.
     if ((csize - req_size) >= HEADER_SIZE)
@@ -424,7 +876,7 @@ static void alloc(void *free_block, size_t req_size)
 		PUT(FTRP(free_block), PACK(csize, 1));
 		remove_block(free_block,csize);
 	}
-
+	PROF_LEAVE();
 }
 
 /*first_fit - Iterates through the free list to search for a free block
@@ -439,6 +891,7 @@ static void *first_fit(size_t req_size)
 	{
 		for (bp = GET_FREE_HEAD(i); GET_ALLOC(HDRP(bp)) == 0; bp =NEXT_FREE_BLK(bp) )
 		{
+			PROF_VISIT();
 			if (req_size <= (size_t) GET_SIZE(HDRP(bp)))
 				return bp;
 		}
@@ -522,7 +975,39 @@ int mm_checkheap(int verbose)
 	return 0;
 }
 
-static int get_free_list_head( unsigned int n)
+#ifdef DRIVER
+/*
+ * mm_heapwalk - Call visit on each block between the prologue and the
+ *               epilogue, in address order
+ */
+void mm_heapwalk(mm_visit_t visit, void *arg)
+{
+	char *bp;
+
+	if (heap_list_head == 0)
+		return;
+	for (bp = heap_list_head; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+		visit(bp, GET_SIZE(HDRP(bp)), GET_ALLOC(HDRP(bp)), arg);
+}
+
+/*
+ * mm_block_waste - Split the allocated block bp, requested with size
+ *                  bytes, the way malloc_block sized it
+ */
+void mm_block_waste(void *bp, size_t size, mm_waste_t *w)
+{
+	size_t bsize = GET_SIZE(HDRP(bp));
+	size_t asize = MAX(ALIGN(size) + DSIZE, HEADER_SIZE);
+
+	w->payload += size;
+	w->meta += DSIZE;
+	w->align += ALIGN(size) - size;
+	w->minblock += asize - (ALIGN(size) + DSIZE);
+	w->remainder += (bsize > asize) ? bsize - asize : 0;
+}
+#endif
+
+static int get_free_list_head(size_t n)
 {
 	int count = 0;
 	while(n>1)
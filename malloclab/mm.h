@@ -2,19 +2,91 @@
 
 #ifdef DRIVER
 
+/*
+ * The driver may run the allocator on several heaps at once, one per
+ * thread (see mem_ctx_bind in memlib.h), so its state is thread-local.
+ */
+#define MM_TLS __thread
+
 /* declare functions for driver tests */
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
 
+/*
+ * Instrumentation for the driver's profiling pass (mdriver -p). While
+ * mm_prof.enabled is set, the allocator counts the free-list nodes it
+ * visits and charges the cycles it spends to one of its internal phases.
+ * The driver clears the counters before each request and reads them
+ * back afterwards.
+ */
+enum {
+    MM_PHASE_SEARCH,      /* looking for a fit in the free lists */
+    MM_PHASE_SPLIT,       /* placing a block and splitting the remainder */
+    MM_PHASE_COALESCE,    /* merging with free neighbours */
+    MM_PHASE_EXTEND,      /* growing the heap with mem_sbrk */
+    MM_NPHASES
+};
+
+typedef struct {
+    int enabled;
+    unsigned long visited;                 /* free-list nodes visited */
+    unsigned long long cycles[MM_NPHASES]; /* cycles spent in each phase */
+} mm_prof_t;
+
+extern MM_TLS mm_prof_t mm_prof;
+
+/*
+ * Access tracing for the driver's cache simulator (mdriver.sim -M). In a
+ * build with -DMM_SIM, every load and store of heap metadata made while
+ * mm_sim.enabled is set is passed to mm_sim.access; mm_sim_built tells
+ * the driver whether this build does.
+ */
+typedef struct {
+    int enabled;
+    void (*access)(const void *addr, size_t size);
+} mm_sim_t;
+
+extern MM_TLS mm_sim_t mm_sim;
+extern const int mm_sim_built;
+
+/*
+ * Heap walk for the driver's fragmentation reports (mdriver -i, -a).
+ * mm_heapwalk calls visit once for each block of the heap, in address
+ * order, with its payload address, the size of the whole block and
+ * whether it is allocated. mm_block_waste adds to w where the bytes of
+ * the allocated block bp went, given the size it was requested with.
+ */
+typedef void (*mm_visit_t)(void *bp, size_t size, int alloc, void *arg);
+
+typedef struct {
+    size_t payload;     /* bytes requested */
+    size_t meta;        /* headers and footers */
+    size_t align;       /* rounding the payload up to the alignment */
+    size_t minblock;    /* padding up to the minimum block size */
+    size_t remainder;   /* left in the block when it was not split */
+} mm_waste_t;
+
+extern void mm_heapwalk(mm_visit_t visit, void *arg);
+extern void mm_block_waste(void *bp, size_t size, mm_waste_t *w);
+
 #else
 
+/* one heap, shared by every thread of the program */
+#define MM_TLS
+
 /* declare functions for interpositioning */
 extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *memalign (size_t alignment, size_t size);
+extern int posix_memalign (void **memptr, size_t alignment, size_t size);
+extern void *aligned_alloc (size_t alignment, size_t size);
+extern void *valloc (size_t size);
+extern void *pvalloc (size_t size);
+extern size_t malloc_usable_size (void *ptr);
 
 #endif
 
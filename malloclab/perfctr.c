@@ -0,0 +1,117 @@
+/*
+ * perfctr.c - hardware event counters for the driver, via perf_event_open
+ *
+ * A handle is simply the counter's file descriptor. On systems without
+ * perf_event_open every counter fails to open.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include "perfctr.h"
+
+#ifdef __linux__
+static const struct {
+    const char *name;
+    unsigned int type;
+    unsigned long long config;
+} events[PERFCTR_NEVENTS] = {
+    [PERFCTR_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE,
+                               PERF_COUNT_HW_INSTRUCTIONS },
+    [PERFCTR_CYCLES] = { "cycles", PERF_TYPE_HARDWARE,
+                         PERF_COUNT_HW_CPU_CYCLES },
+    [PERFCTR_L1D_MISSES] = { "L1d-misses", PERF_TYPE_HW_CACHE,
+                             PERF_COUNT_HW_CACHE_L1D |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    [PERFCTR_LLC_MISSES] = { "LLC-misses", PERF_TYPE_HW_CACHE,
+                             PERF_COUNT_HW_CACHE_LL |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    [PERFCTR_DTLB_MISSES] = { "dTLB-misses", PERF_TYPE_HW_CACHE,
+                              PERF_COUNT_HW_CACHE_DTLB |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    [PERFCTR_BRANCH_MISSES] = { "branch-misses", PERF_TYPE_HARDWARE,
+                                PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+int perfctr_open(int event)
+{
+    struct perf_event_attr attr;
+
+    if (event < 0 || event >= PERFCTR_NEVENTS)
+        return -1;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.disabled = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void perfctr_start(int ctr)
+{
+    ioctl(ctr, PERF_EVENT_IOC_RESET, 0);
+    ioctl(ctr, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+long long perfctr_stop(int ctr)
+{
+    uint64_t v[3];   /* count, time enabled, time running */
+
+    ioctl(ctr, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(ctr, v, sizeof(v)) != sizeof(v) || v[2] == 0)
+        return -1;
+    if (v[2] < v[1])   /* shared the hardware with other counters */
+        return (long long)((double)v[0] * v[1] / v[2]);
+    return v[0];
+}
+
+void perfctr_close(int ctr)
+{
+    close(ctr);
+}
+
+const char *perfctr_name(int event)
+{
+    return events[event].name;
+}
+#else
+int perfctr_open(int event)
+{
+    (void)event;
+    return -1;
+}
+
+void perfctr_start(int ctr)
+{
+    (void)ctr;
+}
+
+long long perfctr_stop(int ctr)
+{
+    (void)ctr;
+    return -1;
+}
+
+void perfctr_close(int ctr)
+{
+    (void)ctr;
+}
+
+const char *perfctr_name(int event)
+{
+    (void)event;
+    return "n/a";
+}
+#endif
@@ -0,0 +1,38 @@
+/*
+ * perfctr.h - hardware event counters for the driver, via perf_event_open
+ *
+ * A counter counts one event for the calling thread, in user mode only.
+ * Counters are not available everywhere (other operating systems,
+ * virtual machines, a restrictive perf_event_paranoid), so callers must
+ * be prepared for perfctr_open to fail and report the event as missing.
+ * When more counters are open than the hardware has, the kernel shares
+ * the hardware between them, and counts are scaled up to the whole time
+ * the counter was enabled.
+ */
+
+/* Events that can be counted */
+enum {
+    PERFCTR_INSTRUCTIONS,  /* instructions retired */
+    PERFCTR_CYCLES,        /* core cycles */
+    PERFCTR_L1D_MISSES,    /* L1 data cache load misses */
+    PERFCTR_LLC_MISSES,    /* last-level cache load misses */
+    PERFCTR_DTLB_MISSES,   /* data TLB load misses */
+    PERFCTR_BRANCH_MISSES, /* mispredicted branches */
+    PERFCTR_NEVENTS
+};
+
+/* Open a counter for event, stopped and zeroed. Returns a handle, or -1
+   if the event cannot be counted here. */
+int perfctr_open(int event);
+
+/* Zero the counter and start counting */
+void perfctr_start(int ctr);
+
+/* Stop counting and return the count, or -1 on error */
+long long perfctr_stop(int ctr);
+
+/* Release the counter */
+void perfctr_close(int ctr);
+
+/* Name of event, for reports */
+const char *perfctr_name(int event);
@@ -0,0 +1,96 @@
+/*
+ * rawmem.h - helpers for code that runs inside the allocator
+ *
+ * heapprof.c and tracelog.c are called from mm_malloc and mm_free, and
+ * in the interpositioning build malloc is the allocator itself, so they
+ * must never call it. They share these helpers: zeroed memory straight
+ * from mmap, output straight through write(2), and open-addressing
+ * tables keyed by block address.
+ *
+ * A table is an array of cap entries of size bytes each, cap a power of
+ * two. Every entry starts with its key, a void *, and a NULL key marks
+ * an empty slot. Collisions are resolved by linear probing.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * raw_map - Get bytes of zeroed memory without calling malloc, or NULL
+ */
+static inline void *raw_map(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/*
+ * raw_write_all - write(2) the whole buffer, retrying on short writes;
+ *     return 0, or -1 on error
+ */
+static inline int raw_write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, buf, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Hash a block address (the finalizer of MurmurHash3) */
+static inline uint64_t raw_hash_ptr(const void *p)
+{
+    uint64_t h = (uint64_t)(uintptr_t)p;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#define RAW_KEY(table, size, i) (*(void **)((char *)(table) + (i) * (size)))
+
+/*
+ * raw_table_find - Return the slot holding key, or -1 if it is absent
+ */
+static inline long raw_table_find(void *table, size_t size, size_t cap,
+                                  const void *key)
+{
+    size_t i;
+
+    for (i = raw_hash_ptr(key) & (cap - 1); RAW_KEY(table, size, i) != key;
+         i = (i + 1) & (cap - 1))
+        if (RAW_KEY(table, size, i) == NULL)
+            return -1;
+    return (long)i;
+}
+
+/*
+ * raw_table_delete - Empty slot i. Backward-shift deletion moves later
+ *     entries of the same probe run up, so no probe sequence is broken
+ *     and no tombstones are needed.
+ */
+static inline void raw_table_delete(void *table, size_t size, size_t cap,
+                                    size_t i)
+{
+    size_t j, home;
+
+    for (j = (i + 1) & (cap - 1); RAW_KEY(table, size, j) != NULL;
+         j = (j + 1) & (cap - 1)) {
+        home = raw_hash_ptr(RAW_KEY(table, size, j)) & (cap - 1);
+        if (((j - home) & (cap - 1)) >= ((j - i) & (cap - 1))) {
+            memcpy((char *)table + i * size, (char *)table + j * size, size);
+            i = j;
+        }
+    }
+    RAW_KEY(table, size, i) = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * repb.h - the binary trace format (.repb)
+ *
+ * A .repb file holds the same requests as a .rep text trace, laid out so
+ * that the driver can map it and replay it in place. The header is
+ * followed by three arrays of num_ops entries each: the request types
+ * (one byte), the block ids (int32_t) and the sizes (uint64_t, zero for
+ * frees). Each array starts on an 8-byte boundary, at the offset the
+ * header gives. Numbers are in the host's byte order; the magic tells a
+ * file from the other byte order apart.
+ *
+ * trconv converts between .rep and .repb.
+ */
+#include <stdint.h>
+
+#define REPB_MAGIC  "MMREPB01"   /* 8 bytes, no terminator */
+#define REPB_ORDER  0x01020304   /* reads differently in the other byte order */
+
+/* Request types, as stored in the type array */
+enum { ALLOC, FREE, REALLOC };
+
+typedef struct {
+    char magic[8];            /* REPB_MAGIC */
+    uint32_t order;           /* REPB_ORDER */
+    int32_t weight;           /* as in the .rep header */
+    int32_t num_ids;
+    int32_t ignore_ranges;
+    int64_t num_ops;
+    uint64_t type_off;        /* file offsets of the three arrays */
+    uint64_t index_off;
+    uint64_t size_off;
+} repb_header_t;
+
+/* Round n up to the next 8-byte boundary */
+#define REPB_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+/* Fill in the array offsets of h for num_ops requests; returns the size
+   of the whole file */
+static inline uint64_t repb_layout(repb_header_t *h, int64_t num_ops)
+{
+    h->num_ops = num_ops;
+    h->type_off = REPB_ALIGN(sizeof(repb_header_t));
+    h->index_off = REPB_ALIGN(h->type_off + num_ops);
+    h->size_off = REPB_ALIGN(h->index_off + num_ops * sizeof(int32_t));
+    return h->size_off + num_ops * sizeof(uint64_t);
+}
+
+/* Check that the three arrays of h lie in order, aligned, inside a file of
+   file_size bytes; returns 1 if they do, 0 if the header is corrupt */
+static inline int repb_check(const repb_header_t *h, uint64_t file_size)
+{
+    return h->num_ops >= 0 && h->size_off <= file_size &&
+        (uint64_t)h->num_ops <= (file_size - h->size_off) / sizeof(uint64_t) &&
+        h->type_off >= sizeof(repb_header_t) &&
+        h->type_off + h->num_ops <= h->index_off &&
+        h->index_off + h->num_ops * sizeof(int32_t) <= h->size_off &&
+        h->index_off % sizeof(int32_t) == 0 &&
+        h->size_off % sizeof(uint64_t) == 0;
+}
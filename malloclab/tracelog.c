@@ -0,0 +1,447 @@
+/*
+ * tracelog.c - record the requests made to the mm malloc package as a
+ *     trace file that mdriver can replay
+ *
+ * Each thread appends fixed-size events to its own single-producer ring
+ * buffer, so recording a request costs a few stores and one atomic
+ * increment of a global sequence number; no locks are taken. A
+ * background flusher thread merges the rings in sequence order, turns
+ * block addresses into the dense block ids used by trace files, and
+ * writes the ops in the same "a id size", "r id size", "f id" syntax
+ * that read_trace parses.
+ *
+ * The header needs the final id and op counts, so tracelog_start writes
+ * it padded to a fixed width and tracelog_stop overwrites it in place
+ * (fscanf ignores the padding). A side file <trace>.ts holds the time,
+ * in nanoseconds from the start of recording, of each op.
+ *
+ * Nothing in here may call malloc: in the interpositioning build, malloc
+ * is the allocator being recorded. Memory comes from mmap and output
+ * goes through write(2), using the helpers in rawmem.h.
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rawmem.h"
+#include "tracelog.h"
+
+#define TL_RING (1 << 14)        /* events per thread (power of two) */
+#define TL_MAX_THREADS 1024      /* threads that can record */
+#define TL_HDRWIDTH 20           /* bytes per (padded) header line */
+#define TL_BUFSIZE (1 << 16)     /* output buffer size */
+#define TL_MAPSIZE (1 << 12)     /* initial size of the id map */
+#define TL_NAP_NS 1000000        /* flusher sleeps this long when idle */
+
+/* One recorded request */
+typedef struct {
+    unsigned long long seq;      /* position in the global order */
+    unsigned long long ns;       /* CLOCK_MONOTONIC time of the request */
+    void *ptr;                   /* block returned (a, r) or freed (f) */
+    void *oldptr;                /* block passed to realloc */
+    size_t size;                 /* requested size */
+    int type;                    /* 'a', 'f' or 'r' */
+} tl_event_t;
+
+/* A thread's ring; head and tail live on separate cache lines */
+typedef struct {
+    unsigned long head;          /* next slot the owning thread fills */
+    char pad1[64 - sizeof(unsigned long)];
+    unsigned long tail;          /* next slot the flusher empties */
+    char pad2[64 - sizeof(unsigned long)];
+    tl_event_t ev[TL_RING];
+} tl_ring_t;
+
+/* Open-addressing map from live block address to trace id (rawmem.h) */
+typedef struct {
+    void *ptr;                   /* key first; NULL marks an empty slot */
+    int id;
+} tl_slot_t;
+
+int tracelog_enabled = 0;
+
+/* shared between recording threads and the flusher */
+static tl_ring_t *rings[TL_MAX_THREADS];
+static int nrings = 0;
+static unsigned long long seq_counter = 0;
+static __thread tl_ring_t *my_ring
+    __attribute__((tls_model("initial-exec"))) = NULL;
+
+static pthread_t flusher;
+static int started = 0;
+static volatile int stopping = 0;
+static unsigned long long start_ns;
+
+/* owned by the flusher */
+static int out_fd = -1, ts_fd = -1;
+static char out_buf[TL_BUFSIZE], ts_buf[TL_BUFSIZE];
+static size_t out_len = 0, ts_len = 0;
+static unsigned long long next_seq = 0;
+static long num_ops = 0;
+static int num_ids = 0;
+static tl_slot_t *map = NULL;
+static size_t map_cap = 0, map_used = 0;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report(const char *msg)
+{
+    if (write(STDERR_FILENO, msg, strlen(msg)) < 0)
+        return;
+}
+
+/*****************************************************
+ * Recording side, called from inside the allocator
+ *****************************************************/
+
+/*
+ * get_ring - Give the calling thread a ring of its own
+ */
+static tl_ring_t *get_ring(void)
+{
+    tl_ring_t *r;
+    int slot = __atomic_fetch_add(&nrings, 1, __ATOMIC_ACQ_REL);
+
+    if (slot >= TL_MAX_THREADS || (r = raw_map(sizeof(tl_ring_t))) == NULL) {
+        report("tracelog: out of thread rings, recording stopped\n");
+        tracelog_enabled = 0;
+        return NULL;
+    }
+    __atomic_store_n(&rings[slot], r, __ATOMIC_RELEASE);
+    return my_ring = r;
+}
+
+static void record(int type, void *ptr, void *oldptr, size_t size)
+{
+    tl_ring_t *r = my_ring;
+    unsigned long head;
+    tl_event_t *e;
+
+    if (r == NULL && (r = get_ring()) == NULL)
+        return;
+
+    /* if the flusher has fallen a whole ring behind, wait for it */
+    head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TL_RING) {
+        if (stopping)
+            return;
+        sched_yield();
+    }
+
+    e = &r->ev[head & (TL_RING - 1)];
+    e->seq = __atomic_fetch_add(&seq_counter, 1, __ATOMIC_RELAXED);
+    e->ns = now_ns();
+    e->ptr = ptr;
+    e->oldptr = oldptr;
+    e->size = size;
+    e->type = type;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void tracelog_malloc(void *ptr, size_t size)
+{
+    record('a', ptr, NULL, size);
+}
+
+void tracelog_free(void *ptr)
+{
+    record('f', ptr, NULL, 0);
+}
+
+void tracelog_realloc(void *oldptr, void *newptr, size_t size)
+{
+    record('r', newptr, oldptr, size);
+}
+
+/*****************************************************
+ * Flusher side
+ *****************************************************/
+
+static void map_put(void *ptr, int id);
+
+/*
+ * map_grow - Double the id map, rehashing every live entry
+ */
+static void map_grow(void)
+{
+    tl_slot_t *old = map;
+    size_t i, old_cap = map_cap;
+
+    map_cap = old_cap ? 2 * old_cap : TL_MAPSIZE;
+    if ((map = raw_map(map_cap * sizeof(tl_slot_t))) == NULL) {
+        report("tracelog: out of memory for the id map\n");
+        exit(1);
+    }
+    map_used = 0;
+    for (i = 0; i < old_cap; i++)
+        if (old[i].ptr != NULL)
+            map_put(old[i].ptr, old[i].id);
+    if (old)
+        munmap(old, old_cap * sizeof(tl_slot_t));
+}
+
+static void map_put(void *ptr, int id)
+{
+    size_t i;
+
+    if (2 * (map_used + 1) > map_cap)
+        map_grow();
+    for (i = raw_hash_ptr(ptr) & (map_cap - 1); map[i].ptr != NULL && map[i].ptr != ptr;
+         i = (i + 1) & (map_cap - 1))
+        ;
+    if (map[i].ptr == NULL)
+        map_used++;
+    map[i].ptr = ptr;
+    map[i].id = id;
+}
+
+/*
+ * map_take - Remove ptr from the map and return its id, or -1 if the
+ *     block was allocated before recording started
+ */
+static int map_take(void *ptr)
+{
+    long i;
+    int id;
+
+    if (map_cap == 0)
+        return -1;
+    if ((i = raw_table_find(map, sizeof(tl_slot_t), map_cap, ptr)) < 0)
+        return -1;
+    id = map[i].id;
+    raw_table_delete(map, sizeof(tl_slot_t), map_cap, i);
+    map_used--;
+    return id;
+}
+
+static void flush_buffers(void)
+{
+    if (raw_write_all(out_fd, out_buf, out_len) < 0 ||
+        raw_write_all(ts_fd, ts_buf, ts_len) < 0)
+        report("tracelog: write failed\n");
+    out_len = ts_len = 0;
+}
+
+/*
+ * emit - Translate one event into a trace op. Requests on blocks that
+ *     were allocated before recording started, and failed requests,
+ *     cannot be replayed and are dropped.
+ */
+static void emit(const tl_event_t *e)
+{
+    int id;
+
+    if (out_len > TL_BUFSIZE - 64 || ts_len > TL_BUFSIZE - 32)
+        flush_buffers();
+
+    switch (e->type) {
+    case 'r':
+        if (e->oldptr != NULL) {
+            if (e->ptr == NULL && e->size != 0)
+                return;                 /* failed; old block untouched */
+            id = map_take(e->oldptr);
+            if (e->size == 0) {         /* realloc(p, 0) frees p */
+                if (id < 0)
+                    return;
+                out_len += snprintf(out_buf + out_len, TL_BUFSIZE - out_len,
+                                    "f %d\n", id);
+                break;
+            }
+            if (id >= 0) {
+                map_put(e->ptr, id);
+                out_len += snprintf(out_buf + out_len, TL_BUFSIZE - out_len,
+                                    "r %d %zu\n", id, e->size);
+                break;
+            }
+        }
+        /* realloc(NULL, n), or of an unknown block: a new allocation */
+        /* fall through */
+    case 'a':
+        if (e->ptr == NULL)
+            return;
+        id = num_ids++;
+        map_put(e->ptr, id);
+        out_len += snprintf(out_buf + out_len, TL_BUFSIZE - out_len,
+                            "a %d %zu\n", id, e->size);
+        break;
+
+    case 'f':
+        id = (e->ptr == NULL) ? -1 : map_take(e->ptr);
+        if (id < 0 && e->ptr != NULL)
+            return;
+        out_len += snprintf(out_buf + out_len, TL_BUFSIZE - out_len,
+                            "f %d\n", id);
+        break;
+
+    default:
+        return;
+    }
+
+    num_ops++;
+    ts_len += snprintf(ts_buf + ts_len, TL_BUFSIZE - ts_len, "%llu\n",
+                       e->ns - start_ns);
+}
+
+/*
+ * drain - Write out every event that is next in sequence order. If
+ *     force is set, don't wait for events that were numbered but never
+ *     published (their thread was caught mid-request at exit).
+ */
+static void drain(int force)
+{
+    int i, n, progress;
+    unsigned long head;
+    unsigned long long lowest;
+    tl_ring_t *r;
+
+    do {
+        progress = 0;
+        lowest = ~0ULL;
+        n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+        if (n > TL_MAX_THREADS)
+            n = TL_MAX_THREADS;
+        for (i = 0; i < n; i++) {
+            if ((r = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE)) == NULL)
+                continue;
+            head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            while (r->tail != head) {
+                tl_event_t *e = &r->ev[r->tail & (TL_RING - 1)];
+                if (e->seq != next_seq) {
+                    if (e->seq < lowest)
+                        lowest = e->seq;
+                    break;
+                }
+                emit(e);
+                next_seq++;
+                __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+                progress = 1;
+            }
+        }
+        if (!progress && force && lowest != ~0ULL) {
+            next_seq = lowest;
+            progress = 1;
+        }
+    } while (progress);
+    flush_buffers();
+}
+
+static void *flush_loop(void *arg __attribute__((unused)))
+{
+    struct timespec nap = { 0, TL_NAP_NS };
+
+    while (!stopping) {
+        drain(0);
+        nanosleep(&nap, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * write_header - Write the four header lines, padded to a fixed width
+ *     so that the final counts can be filled in without moving the ops
+ */
+static void write_header(void)
+{
+    char buf[4 * TL_HDRWIDTH + 1];
+    int w = TL_HDRWIDTH - 1;
+
+    snprintf(buf, sizeof(buf), "%-*d\n%-*d\n%-*ld\n%-*d\n",
+             w, 1,             /* weight */
+             w, num_ids,       /* number of ids */
+             w, num_ops,       /* number of ops */
+             w, 0);            /* ignore ranges */
+    if (pwrite(out_fd, buf, 4 * TL_HDRWIDTH, 0) != 4 * TL_HDRWIDTH)
+        report("tracelog: could not write the trace header\n");
+}
+
+void tracelog_start(const char *path)
+{
+    char ts_path[4096];
+
+    if (started)
+        return;
+    snprintf(ts_path, sizeof(ts_path), "%s.ts", path);
+    if ((out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+        (ts_fd = open(ts_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        report("tracelog: could not create the trace file\n");
+        return;
+    }
+    write_header();
+    lseek(out_fd, 4 * TL_HDRWIDTH, SEEK_SET);
+
+    start_ns = now_ns();
+    stopping = 0;
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0) {
+        report("tracelog: could not start the flusher thread\n");
+        return;
+    }
+    started = 1;
+    tracelog_enabled = 1;
+}
+
+void tracelog_start_from_env(void)
+{
+    char *path = getenv("MM_TRACE");
+
+    if (path == NULL || started)
+        return;
+    tracelog_start(path);
+    if (started)
+        atexit(tracelog_stop);
+}
+
+/*
+ * tracelog_fork_child - Forget the parent's recording in a child created
+ *     by fork. The flusher thread is not copied, and the trace file is
+ *     the parent's to finish, so tracelog_stop must do nothing here.
+ */
+void tracelog_fork_child(void)
+{
+    int i;
+
+    tracelog_enabled = 0;
+    if (!started)
+        return;
+    started = 0;
+    close(out_fd);
+    close(ts_fd);
+    out_fd = ts_fd = -1;
+    out_len = ts_len = 0;
+    for (i = 0; i < nrings && i < TL_MAX_THREADS; i++)
+        if (rings[i] != NULL) {
+            munmap(rings[i], sizeof(tl_ring_t));
+            rings[i] = NULL;
+        }
+    nrings = 0;
+    my_ring = NULL;
+    if (map != NULL)
+        munmap(map, map_cap * sizeof(tl_slot_t));
+    map = NULL;
+    map_cap = map_used = 0;
+}
+
+void tracelog_stop(void)
+{
+    if (!started)
+        return;
+    tracelog_enabled = 0;
+    stopping = 1;
+    pthread_join(flusher, NULL);
+    drain(1);
+    write_header();
+    close(out_fd);
+    close(ts_fd);
+    started = 0;
+}
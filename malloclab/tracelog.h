@@ -0,0 +1,30 @@
+/*
+ * tracelog.h - record the requests made to the mm malloc package as a
+ *     trace file that mdriver can replay
+ *
+ * Only used in the interpositioning build (DRIVER undefined). Set
+ * MM_TRACE=<file> in the environment to capture a program's requests.
+ */
+#include <stddef.h>
+
+/* Nonzero while requests are being recorded */
+extern int tracelog_enabled;
+
+/* Start recording to path, replacing any existing file */
+void tracelog_start(const char *path);
+
+/* Start recording if MM_TRACE=<file> is set in the environment, and
+   finish the trace when the program exits */
+void tracelog_start_from_env(void);
+
+/* Flush the remaining requests and complete the trace header */
+void tracelog_stop(void);
+
+/* Called in the child after fork: drop the parent's recording without
+   touching its trace file */
+void tracelog_fork_child(void);
+
+/* Called by mm.c, from inside the request, once per request */
+void tracelog_malloc(void *ptr, size_t size);
+void tracelog_free(void *ptr);
+void tracelog_realloc(void *oldptr, void *newptr, size_t size);
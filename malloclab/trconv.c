@@ -0,0 +1,221 @@
+/*
+ * trconv.c - convert traces between the text (.rep) and binary (.repb)
+ *     formats
+ *
+ * usage: trconv <in> <out>
+ *
+ * The direction follows from the name of the input: a .repb file is
+ * written out as text, anything else is read as text and written out as
+ * a .repb (see repb.h). Text traces are read one line at a time and the
+ * binary arrays are written through fixed-size buffers, so traces of any
+ * length convert in constant memory.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "repb.h"
+
+#define MAXLINE 1024
+#define CHUNK   (1 << 16)   /* requests buffered per array */
+
+static const char *progname = "trconv";
+
+static void die(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2), noreturn));
+
+static void die(const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s: ", progname);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    if (errno != 0)
+        fprintf(stderr, ": %s", strerror(errno));
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* Write len bytes of buf at offset off of fd */
+static void put(int fd, const void *buf, size_t len, uint64_t off)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = pwrite(fd, p, len, off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            die("write failed");
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+}
+
+/* Requests read but not yet written */
+static uint8_t types[CHUNK];
+static int32_t ids[CHUNK];
+static uint64_t sizes[CHUNK];
+
+/* Write the first n buffered requests to fd as requests op.. of h */
+static void flush(int fd, const repb_header_t *h, int64_t op, int n)
+{
+    put(fd, types, n, h->type_off + op);
+    put(fd, ids, n * sizeof(*ids), h->index_off + op * sizeof(*ids));
+    put(fd, sizes, n * sizeof(*sizes), h->size_off + op * sizeof(*sizes));
+}
+
+/*
+ * rep_to_repb - convert the text trace in to a binary trace at out
+ */
+static void rep_to_repb(const char *in, const char *out)
+{
+    repb_header_t h;
+    char line[MAXLINE];
+    char type;
+    long id;
+    long long num_ops;
+    unsigned long long size;
+    int64_t op = 0;
+    int n = 0, max_id = -1;
+    int fd;
+    FILE *f;
+
+    if ((f = fopen(in, "r")) == NULL)
+        die("cannot open %s", in);
+    memset(&h, 0, sizeof(h));
+    errno = 0;
+    if (fscanf(f, "%d %d %lld %d", &h.weight, &h.num_ids, &num_ops,
+               &h.ignore_ranges) != 4 || num_ops < 0 || h.num_ids < 0)
+        die("%s: bad trace header", in);
+    memcpy(h.magic, REPB_MAGIC, sizeof(h.magic));
+    h.order = REPB_ORDER;
+    repb_layout(&h, num_ops);
+
+    if ((fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        die("cannot create %s", out);
+
+    while (op + n < h.num_ops && fgets(line, sizeof(line), f) != NULL) {
+        size = 0;
+        if (sscanf(line, " %c %ld %llu", &type, &id, &size) < 2)
+            continue;   /* blank line, or the end of the header */
+        switch (type) {
+        case 'a': types[n] = ALLOC; break;
+        case 'r': types[n] = REALLOC; break;
+        case 'f': types[n] = FREE; size = 0; break;
+        default:
+            errno = 0;
+            die("%s, line %lld: bogus request type '%c'", in,
+                (long long)(op + n + 5), type);
+        }
+        if (id >= h.num_ids || (id < 0 && type != 'f')) {
+            errno = 0;
+            die("%s, line %lld: block id %ld out of range", in,
+                (long long)(op + n + 5), id);
+        }
+        ids[n] = id;
+        sizes[n] = size;
+        max_id = (id > max_id) ? id : max_id;
+        if (++n == CHUNK) {
+            flush(fd, &h, op, n);
+            op += n;
+            n = 0;
+        }
+    }
+    flush(fd, &h, op, n);
+    op += n;
+    fclose(f);
+
+    errno = 0;
+    if (op != h.num_ops)
+        die("%s: header says %lld requests, found %lld", in,
+            (long long)h.num_ops, (long long)op);
+    if (max_id != h.num_ids - 1)
+        die("%s: header says %d ids, found %d", in, h.num_ids, max_id + 1);
+
+    /* the header goes last, so an interrupted conversion never looks
+       like a valid trace */
+    put(fd, &h, sizeof(h), 0);
+    if (close(fd) < 0)
+        die("cannot write %s", out);
+}
+
+/*
+ * repb_to_rep - convert the binary trace in to a text trace at out
+ */
+static void repb_to_rep(const char *in, const char *out)
+{
+    static const char type_chars[] = { 'a', 'f', 'r' };
+    const repb_header_t *h;
+    const uint8_t *types;
+    const int32_t *ids;
+    const uint64_t *sizes;
+    struct stat st;
+    char *map;
+    int64_t i;
+    int fd;
+    FILE *f;
+
+    if ((fd = open(in, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        die("cannot open %s", in);
+    if ((size_t)st.st_size < sizeof(*h))
+        die("%s: truncated binary trace", in);
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        die("cannot map %s", in);
+    close(fd);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    h = (const repb_header_t *)map;
+    errno = 0;
+    if (memcmp(h->magic, REPB_MAGIC, sizeof(h->magic)) != 0 || h->order != REPB_ORDER)
+        die("%s: not a binary trace for this machine", in);
+    if (!repb_check(h, st.st_size))
+        die("%s: corrupt binary trace header", in);
+    types = (const uint8_t *)(map + h->type_off);
+    ids = (const int32_t *)(map + h->index_off);
+    sizes = (const uint64_t *)(map + h->size_off);
+
+    if ((f = fopen(out, "w")) == NULL)
+        die("cannot create %s", out);
+    fprintf(f, "%d\n%d\n%lld\n%d\n", h->weight, h->num_ids,
+            (long long)h->num_ops, h->ignore_ranges);
+    for (i = 0; i < h->num_ops; i++) {
+        if (types[i] > REALLOC)
+            die("%s: bogus request type %d", in, types[i]);
+        if (types[i] == FREE)
+            fprintf(f, "f %d\n", ids[i]);
+        else
+            fprintf(f, "%c %d %llu\n", type_chars[types[i]], ids[i],
+                    (unsigned long long)sizes[i]);
+    }
+    if (fclose(f) != 0)
+        die("cannot write %s", out);
+    munmap(map, st.st_size);
+}
+
+int main(int argc, char **argv)
+{
+    size_t len;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <in.rep> <out.repb>\n"
+                "       %s <in.repb> <out.rep>\n", argv[0], argv[0]);
+        exit(1);
+    }
+    len = strlen(argv[1]);
+    if (len > 5 && strcmp(argv[1] + len - 5, ".repb") == 0)
+        repb_to_rep(argv[1], argv[2]);
+    else
+        rep_to_repb(argv[1], argv[2]);
+    return 0;
+}
@@ -0,0 +1,401 @@
+/*
+ * tstream.c - stream the requests of a trace from disk (mdriver -S)
+ *
+ * The two chunk buffers are used alternately: the reader thread fills
+ * chunk k+1 while the driver replays chunk k, and waits for chunk k to
+ * be handed back before it overwrites it. A chunk with no requests marks
+ * the end of the trace.
+ *
+ * Slots are assigned in the reader, in trace order: a block gets a slot
+ * when it is allocated and gives it back when it is freed, and the next
+ * allocation takes the most recently freed slot. The driver replays in
+ * the same order, so a slot is never reused before the free that
+ * released it has been replayed. Live ids are found through an open
+ * addressing hash table, so the reader's memory is also bounded by the
+ * number of live blocks rather than by the number of ids in the trace.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tstream.h"
+#include "repb.h"
+
+#define TS_CHUNK 8192   /* requests per chunk */
+#define MAXLINE  1024
+
+typedef struct {
+    uint8_t type[TS_CHUNK];
+    int32_t slot[TS_CHUNK];
+    uint64_t size[TS_CHUNK];
+    long n;             /* requests in the chunk; 0 at the end */
+    int nslots;         /* slots used up to the end of the chunk */
+    int full;           /* filled and not yet handed back */
+} chunk_t;
+
+struct tstream {
+    char path[MAXLINE];
+    int binary;
+    FILE *text;             /* .rep: the file, and where the requests start */
+    long text_start;
+    int fd;                 /* .repb: the file and its header */
+    repb_header_t h;
+    long num_ops;
+
+    pthread_t reader;
+    int running;
+    int stop;               /* tells the reader to quit */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    chunk_t chunk[2];
+    long taken;             /* chunks handed to the driver so far */
+    int held;               /* the driver holds chunk taken-1 */
+
+    /* reader state */
+    long done;              /* requests read */
+    int32_t *ids;           /* hash table of live ids (-1 for empty) ... */
+    int32_t *slots;         /* ... and their slots */
+    size_t cap, live;
+    int32_t *free_slots;    /* stack of released slots */
+    size_t nfree;
+    int nslots;
+};
+
+static void ts_error(tstream_t *ts, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3), noreturn));
+
+static void ts_error(tstream_t *ts, const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s: ", ts->path);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/*****************************
+ * Live id table and slot pool
+ *****************************/
+
+static size_t hash(tstream_t *ts, int32_t id)
+{
+    return ((uint32_t)id * 2654435761u) & (ts->cap - 1);
+}
+
+static void map_grow(tstream_t *ts)
+{
+    int32_t *ids = ts->ids, *slots = ts->slots;
+    size_t cap = ts->cap, i, j;
+
+    ts->cap = cap ? 2 * cap : 1024;
+    if ((ts->ids = malloc(ts->cap * sizeof(*ts->ids))) == NULL ||
+        (ts->slots = malloc(ts->cap * sizeof(*ts->slots))) == NULL ||
+        (ts->free_slots = realloc(ts->free_slots,
+                                  ts->cap / 2 * sizeof(*ts->free_slots))) == NULL)
+        ts_error(ts, "out of memory for the id table");
+    memset(ts->ids, -1, ts->cap * sizeof(*ts->ids));
+    for (i = 0; i < cap; i++) {
+        if (ids[i] < 0)
+            continue;
+        for (j = hash(ts, ids[i]); ts->ids[j] >= 0; j = (j + 1) & (ts->cap - 1))
+            ;
+        ts->ids[j] = ids[i];
+        ts->slots[j] = slots[i];
+    }
+    free(ids);
+    free(slots);
+}
+
+/* Give the newly allocated block id a slot */
+static int32_t slot_new(tstream_t *ts, int32_t id)
+{
+    size_t i;
+    int32_t slot;
+
+    if (2 * (ts->live + 1) > ts->cap)
+        map_grow(ts);
+    for (i = hash(ts, id); ts->ids[i] >= 0; i = (i + 1) & (ts->cap - 1))
+        if (ts->ids[i] == id)
+            ts_error(ts, "request %ld allocates block %d, which is live",
+                     ts->done + 1, id);
+    slot = ts->nfree > 0 ? ts->free_slots[--ts->nfree] : ts->nslots++;
+    ts->ids[i] = id;
+    ts->slots[i] = slot;
+    ts->live++;
+    return slot;
+}
+
+/* Find the slot of the live block id, or return -1 */
+static int32_t slot_find(tstream_t *ts, int32_t id, size_t *pos)
+{
+    size_t i;
+
+    if (id < 0 || ts->cap == 0)
+        return -1;
+    for (i = hash(ts, id); ts->ids[i] >= 0; i = (i + 1) & (ts->cap - 1))
+        if (ts->ids[i] == id) {
+            *pos = i;
+            return ts->slots[i];
+        }
+    return -1;
+}
+
+/* Release the slot of block id, which is being freed */
+static int32_t slot_free(tstream_t *ts, int32_t id)
+{
+    size_t i, j, k;
+    int32_t slot;
+
+    if ((slot = slot_find(ts, id, &i)) < 0)
+        return -1;   /* free(NULL) */
+    ts->free_slots[ts->nfree++] = slot;
+    ts->live--;
+
+    /* backward-shift deletion keeps every probe sequence unbroken */
+    for (j = (i + 1) & (ts->cap - 1); ts->ids[j] >= 0; j = (j + 1) & (ts->cap - 1)) {
+        k = hash(ts, ts->ids[j]);
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            ts->ids[i] = ts->ids[j];
+            ts->slots[i] = ts->slots[j];
+            i = j;
+        }
+    }
+    ts->ids[i] = -1;
+    return slot;
+}
+
+/* Turn the block ids of the n requests in c into slots */
+static void remap(tstream_t *ts, chunk_t *c, long n)
+{
+    size_t pos;
+    long i;
+
+    for (i = 0; i < n; i++, ts->done++) {
+        switch (c->type[i]) {
+        case ALLOC:
+            c->slot[i] = slot_new(ts, c->slot[i]);
+            break;
+        case REALLOC:   /* of a block that is not live, acts as malloc */
+            if (slot_find(ts, c->slot[i], &pos) >= 0)
+                c->slot[i] = ts->slots[pos];
+            else
+                c->slot[i] = slot_new(ts, c->slot[i]);
+            break;
+        case FREE:
+            c->slot[i] = slot_free(ts, c->slot[i]);
+            break;
+        default:
+            ts_error(ts, "request %ld has bogus type %d", ts->done + 1, c->type[i]);
+        }
+    }
+}
+
+/***************
+ * Reader thread
+ ***************/
+
+/* Read up to TS_CHUNK requests of a text trace into c; returns how many */
+static long read_text(tstream_t *ts, chunk_t *c)
+{
+    char line[MAXLINE], *p, *end;
+    long n = 0;
+
+    while (n < TS_CHUNK && ts->done + n < ts->num_ops &&
+           fgets(line, sizeof(line), ts->text) != NULL) {
+        for (p = line; *p == ' ' || *p == '\t'; p++)
+            ;
+        switch (*p) {
+        case 'a': c->type[n] = ALLOC; break;
+        case 'r': c->type[n] = REALLOC; break;
+        case 'f': c->type[n] = FREE; break;
+        case '\n': case '\r': case '\0': continue;
+        default:
+            ts_error(ts, "bogus type character (%c) in request %ld",
+                     *p, ts->done + n + 1);
+        }
+        c->slot[n] = strtol(p + 1, &end, 10);
+        c->size[n] = (c->type[n] == FREE) ? 0 : strtoull(end, NULL, 10);
+        n++;
+    }
+    return n;
+}
+
+/* Read up to TS_CHUNK requests of a binary trace into c; returns how many */
+static long read_binary(tstream_t *ts, chunk_t *c)
+{
+    long n = ts->num_ops - ts->done;
+    long first = ts->done;
+
+    n = (n < TS_CHUNK) ? n : TS_CHUNK;
+    if (n > 0 &&
+        (pread(ts->fd, c->type, n, ts->h.type_off + first) != n ||
+         pread(ts->fd, c->slot, n * sizeof(int32_t),
+               ts->h.index_off + first * sizeof(int32_t)) != (ssize_t)(n * sizeof(int32_t)) ||
+         pread(ts->fd, c->size, n * sizeof(uint64_t),
+               ts->h.size_off + first * sizeof(uint64_t)) != (ssize_t)(n * sizeof(uint64_t))))
+        ts_error(ts, "read of requests %ld.. failed", first + 1);
+    return n;
+}
+
+static void *reader(void *arg)
+{
+    tstream_t *ts = arg;
+    chunk_t *c;
+    long k, n;
+
+    for (k = 0; ; k++) {
+        c = &ts->chunk[k & 1];
+        pthread_mutex_lock(&ts->lock);
+        while (c->full && !ts->stop)
+            pthread_cond_wait(&ts->cond, &ts->lock);
+        pthread_mutex_unlock(&ts->lock);
+        if (ts->stop)
+            break;
+
+        n = ts->binary ? read_binary(ts, c) : read_text(ts, c);
+        if (n == 0 && ts->done < ts->num_ops)
+            ts_error(ts, "trace ends after %ld of %ld requests",
+                     ts->done, ts->num_ops);
+        remap(ts, c, n);
+        c->n = n;
+        c->nslots = ts->nslots;
+
+        pthread_mutex_lock(&ts->lock);
+        c->full = 1;
+        pthread_cond_broadcast(&ts->cond);
+        pthread_mutex_unlock(&ts->lock);
+        if (n == 0)
+            break;
+    }
+    return NULL;
+}
+
+/******************
+ * Public functions
+ ******************/
+
+tstream_t *tstream_open(const char *path, int *weight, int *num_ids,
+                        long *num_ops, int *ignore_ranges)
+{
+    tstream_t *ts;
+    size_t len = strlen(path);
+
+    if ((ts = calloc(1, sizeof(*ts))) == NULL)
+        return NULL;
+    snprintf(ts->path, sizeof(ts->path), "%s", path);
+    ts->binary = (len > 5 && strcmp(path + len - 5, ".repb") == 0);
+    ts->fd = -1;
+    if (ts->binary) {
+        if ((ts->fd = open(path, O_RDONLY)) < 0) {
+            free(ts);
+            return NULL;
+        }
+        if (pread(ts->fd, &ts->h, sizeof(ts->h), 0) != sizeof(ts->h) ||
+            memcmp(ts->h.magic, REPB_MAGIC, sizeof(ts->h.magic)) != 0 ||
+            ts->h.order != REPB_ORDER || ts->h.num_ops < 0)
+            ts_error(ts, "not a binary trace for this machine");
+        *weight = ts->h.weight;
+        *num_ids = ts->h.num_ids;
+        *num_ops = ts->h.num_ops;
+        *ignore_ranges = ts->h.ignore_ranges;
+    } else {
+        if ((ts->text = fopen(path, "r")) == NULL) {
+            free(ts);
+            return NULL;
+        }
+        if (fscanf(ts->text, "%d %d %ld %d", weight, num_ids, num_ops,
+                   ignore_ranges) != 4 || *num_ops < 0)
+            ts_error(ts, "bad trace header");
+        ts->text_start = ftell(ts->text);
+    }
+    ts->num_ops = *num_ops;
+    pthread_mutex_init(&ts->lock, NULL);
+    pthread_cond_init(&ts->cond, NULL);
+    return ts;
+}
+
+/* Stop the reader thread, if it is running */
+static void stop_reader(tstream_t *ts)
+{
+    if (!ts->running)
+        return;
+    pthread_mutex_lock(&ts->lock);
+    ts->stop = 1;
+    pthread_cond_broadcast(&ts->cond);
+    pthread_mutex_unlock(&ts->lock);
+    pthread_join(ts->reader, NULL);
+    ts->running = 0;
+}
+
+void tstream_start(tstream_t *ts)
+{
+    stop_reader(ts);
+    if (!ts->binary && fseek(ts->text, ts->text_start, SEEK_SET) < 0)
+        ts_error(ts, "cannot rewind: %s", strerror(errno));
+    ts->chunk[0].full = ts->chunk[1].full = 0;
+    ts->taken = 0;
+    ts->held = 0;
+    ts->stop = 0;
+    ts->done = 0;
+    if (ts->cap > 0)
+        memset(ts->ids, -1, ts->cap * sizeof(*ts->ids));
+    ts->live = 0;
+    ts->nfree = 0;
+    ts->nslots = 0;
+    if (pthread_create(&ts->reader, NULL, reader, ts) != 0)
+        ts_error(ts, "cannot start the reader thread");
+    ts->running = 1;
+}
+
+long tstream_next(tstream_t *ts, uint8_t **type, int32_t **slot,
+                  uint64_t **size, int *nslots)
+{
+    chunk_t *c;
+
+    pthread_mutex_lock(&ts->lock);
+    if (ts->held) {
+        ts->chunk[(ts->taken - 1) & 1].full = 0;
+        ts->held = 0;
+        pthread_cond_broadcast(&ts->cond);
+    }
+    c = &ts->chunk[ts->taken & 1];
+    while (!c->full)
+        pthread_cond_wait(&ts->cond, &ts->lock);
+    pthread_mutex_unlock(&ts->lock);
+
+    if (c->n == 0)
+        return 0;
+    ts->taken++;
+    ts->held = 1;
+    *type = c->type;
+    *slot = c->slot;
+    *size = c->size;
+    if (c->nslots > *nslots)
+        *nslots = c->nslots;
+    return c->n;
+}
+
+void tstream_close(tstream_t *ts)
+{
+    if (ts == NULL)
+        return;
+    stop_reader(ts);
+    if (ts->text != NULL)
+        fclose(ts->text);
+    if (ts->fd >= 0)
+        close(ts->fd);
+    pthread_mutex_destroy(&ts->lock);
+    pthread_cond_destroy(&ts->cond);
+    free(ts->ids);
+    free(ts->slots);
+    free(ts->free_slots);
+    free(ts);
+}
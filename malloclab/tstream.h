@@ -0,0 +1,33 @@
+/*
+ * tstream.h - stream the requests of a trace from disk (mdriver -S)
+ *
+ * A stream hands out the requests of a .rep or .repb trace a chunk at a
+ * time. A reader thread fills the next chunk while the driver replays
+ * the current one, so only two chunks are ever in memory. The reader also
+ * renumbers the block ids into slots, reusing the slot of a freed block,
+ * so the driver's per-block arrays need only as many entries as there
+ * are blocks live at once.
+ */
+#include <stdint.h>
+
+typedef struct tstream tstream_t;
+
+/* Open the trace at path (binary if it is named *.repb) and read its
+   header. Returns NULL, with errno set, if the file cannot be read. */
+tstream_t *tstream_open(const char *path, int *weight, int *num_ids,
+                        long *num_ops, int *ignore_ranges);
+
+/* Start (or restart) reading from the first request */
+void tstream_start(tstream_t *ts);
+
+/*
+ * Release the previous chunk and return the number of requests in the
+ * next one, or 0 at the end of the trace. The chunk's requests are
+ * returned through type, slot and size; they stay valid until the next
+ * call. *nslots is raised to the number of slots used so far.
+ */
+long tstream_next(tstream_t *ts, uint8_t **type, int32_t **slot,
+                  uint64_t **size, int *nslots);
+
+/* Stop the reader and close the trace */
+void tstream_close(tstream_t *ts);